@@ -0,0 +1,254 @@
+/* vim: set ai noet ts=4 sw=4 tw=115: */
+//
+// Copyright (c) 2014 Nikolay Zapolnov (zapolnov@gmail.com).
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "path-util-async.h"
+
+#ifdef PATH_UTIL_HAS_COROUTINES
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct PathAsyncPool
+{
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::deque<std::shared_ptr<PathAsyncJob>> queue;
+	std::vector<std::thread> threads;
+	std::function<void(std::coroutine_handle<>)> resumeHandler;
+	size_t limit;
+	size_t waiting;
+	bool stopping;
+
+	PathAsyncPool()
+		: limit(4),
+		  waiting(0),
+		  stopping(false)
+	{
+	}
+
+	~PathAsyncPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		condition.notify_all();
+		for (std::thread & thread : threads)
+			thread.join();
+	}
+};
+
+static PathAsyncPool & pathAsyncPool()
+{
+	static PathAsyncPool pool;
+	return pool;
+}
+
+static void pathAsyncResume(std::coroutine_handle<> continuation)
+{
+	PathAsyncPool & pool = pathAsyncPool();
+	std::function<void(std::coroutine_handle<>)> handler;
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		handler = pool.resumeHandler;
+	}
+
+	if (handler)
+		handler(continuation);
+	else
+		continuation.resume();
+}
+
+static void pathAsyncExecute(const std::shared_ptr<PathAsyncJob> & job)
+{
+	int expected = PathAsyncJob::State_Pending;
+	if (!job->state.compare_exchange_strong(expected, PathAsyncJob::State_Running))
+		return;
+
+	try
+	{
+		job->execute();
+	}
+	catch (...)
+	{
+		job->error = std::current_exception();
+	}
+
+	job->state.store(PathAsyncJob::State_Finished);
+	pathAsyncResume(job->continuation);
+}
+
+// Workers with an index at or above the current limit stay parked, so lowering the limit takes effect without
+// having to stop threads that may be blocked in a system call.
+static void pathAsyncWorker(PathAsyncPool * pool, size_t index)
+{
+	std::unique_lock<std::mutex> lock(pool->mutex);
+	for (;;)
+	{
+		if (pool->stopping)
+			return;
+
+		if (index >= pool->limit || pool->queue.empty())
+		{
+			bool counted = (index < pool->limit);
+			if (counted)
+				++pool->waiting;
+			pool->condition.wait(lock);
+			if (counted)
+				--pool->waiting;
+			continue;
+		}
+
+		std::shared_ptr<PathAsyncJob> job = std::move(pool->queue.front());
+		pool->queue.pop_front();
+
+		lock.unlock();
+		pathAsyncExecute(job);
+		job.reset();
+		lock.lock();
+	}
+}
+
+void PathAsyncCancelCallback::operator()() const noexcept
+{
+	int expected = PathAsyncJob::State_Pending;
+	if (job->state.compare_exchange_strong(expected, PathAsyncJob::State_Cancelled))
+	{
+		pathAsyncResume(job->continuation);
+		return;
+	}
+
+	// Still inside pathAsyncSubmit: it will notice the cancellation and won't suspend the coroutine.
+	expected = PathAsyncJob::State_Initial;
+	job->state.compare_exchange_strong(expected, PathAsyncJob::State_Cancelled);
+}
+
+bool pathAsyncSubmit(const std::shared_ptr<PathAsyncJob> & job, std::coroutine_handle<> continuation,
+	const std::stop_token & token)
+{
+	job->continuation = continuation;
+	if (token.stop_possible())
+		job->stopCallback.emplace(token, PathAsyncCancelCallback{job.get()});
+
+	int expected = PathAsyncJob::State_Initial;
+	if (!job->state.compare_exchange_strong(expected, PathAsyncJob::State_Pending))
+		return false;
+
+	PathAsyncPool & pool = pathAsyncPool();
+	bool notifyAll;
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		if (pool.stopping)
+			throw std::runtime_error("unable to submit path operation: thread pool is shutting down.");
+
+		pool.queue.push_back(job);
+		if (pool.queue.size() > pool.waiting && pool.threads.size() < pool.limit)
+		{
+			try
+			{
+				pool.threads.emplace_back(pathAsyncWorker, &pool, pool.threads.size());
+				return true;
+			}
+			catch (...)
+			{
+				// Existing workers will get to the job eventually. Without any, take it back out of the queue
+				// before the exception resumes the coroutine, so that nothing can resume it a second time.
+				if (pool.threads.empty())
+				{
+					pool.queue.pop_back();
+					expected = PathAsyncJob::State_Pending;
+					if (job->state.compare_exchange_strong(expected, PathAsyncJob::State_Finished))
+						throw;
+					return true;	// Cancelled concurrently; the stop callback resumes the coroutine.
+				}
+			}
+		}
+		notifyAll = (pool.threads.size() > pool.limit);
+	}
+
+	if (notifyAll)
+		pool.condition.notify_all();
+	else
+		pool.condition.notify_one();
+
+	return true;
+}
+
+void pathSetAsyncConcurrency(size_t maxThreads)
+{
+	if (maxThreads == 0)
+		throw std::runtime_error("concurrency limit for path operations should be greater than zero.");
+
+	PathAsyncPool & pool = pathAsyncPool();
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.limit = maxThreads;
+		while (pool.threads.size() < std::min(pool.limit, pool.queue.size()))
+			pool.threads.emplace_back(pathAsyncWorker, &pool, pool.threads.size());
+	}
+	pool.condition.notify_all();
+}
+
+size_t pathGetAsyncConcurrency()
+{
+	PathAsyncPool & pool = pathAsyncPool();
+	std::lock_guard<std::mutex> lock(pool.mutex);
+	return pool.limit;
+}
+
+void pathSetAsyncResumeHandler(std::function<void(std::coroutine_handle<>)> handler)
+{
+	PathAsyncPool & pool = pathAsyncPool();
+	std::lock_guard<std::mutex> lock(pool.mutex);
+	pool.resumeHandler = std::move(handler);
+}
+
+PathAsyncOperation<bool> pathIsFileAsync(const std::string & path, std::stop_token token)
+{
+	return PathAsyncOperation<bool>([path]() { return pathIsFile(path); }, std::move(token));
+}
+
+PathAsyncOperation<bool> pathCreateAsync(const std::string & path, std::stop_token token)
+{
+	return PathAsyncOperation<bool>([path]() { return pathCreate(path); }, std::move(token));
+}
+
+PathAsyncOperation<std::string> pathMakeCanonicalAsync(const std::string & path, std::stop_token token)
+{
+	return PathAsyncOperation<std::string>([path]() { return pathMakeCanonical(path); }, std::move(token));
+}
+
+PathAsyncOperation<DirEntryList> pathEnumDirectoryContentsAsync(const std::string & path, std::stop_token token)
+{
+	return PathAsyncOperation<DirEntryList>([path]() { return pathEnumDirectoryContents(path); }, std::move(token));
+}
+
+PathAsyncOperation<void> pathDeleteFileAsync(const std::string & path, std::stop_token token)
+{
+	return PathAsyncOperation<void>([path]() { pathDeleteFile(path); }, std::move(token));
+}
+
+#endif
@@ -0,0 +1,177 @@
+/* vim: set ai noet ts=4 sw=4 tw=115: */
+//
+// Copyright (c) 2014 Nikolay Zapolnov (zapolnov@gmail.com).
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#ifndef __cacd48d203081c94f97d0cff79c49ecb__
+#define __cacd48d203081c94f97d0cff79c49ecb__
+
+#include "path-util.h"
+
+// The async API needs C++20 and lives in a separate library, path-util-async (the PATH_UTIL_ASYNC option in
+// CMake), which defines PATH_UTIL_ASYNC for itself and for code that links to it.
+#ifdef PATH_UTIL_ASYNC
+ #ifndef __cpp_impl_coroutine
+  #error "path-util-async requires a compiler with C++20 coroutine support."
+ #endif
+ #define PATH_UTIL_HAS_COROUTINES 1
+#endif
+
+#ifdef PATH_UTIL_HAS_COROUTINES
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <stop_token>
+
+// The operations below run the corresponding blocking function on a bounded pool of worker threads and resume
+// the awaiting coroutine once it completes. By default the coroutine is resumed on the worker thread; install a
+// resume handler to have it posted back to an event loop instead.
+//
+// An operation that has not started yet when its stop token is triggered completes with PathOperationCancelled.
+// Operations that are already running are allowed to finish, since blocking system calls can't be interrupted.
+// A stop requested before the operation is submitted completes it right away, without suspending. A queued
+// operation is resumed from inside request_stop(): on the thread that called it when no resume handler is
+// installed, or through the resume handler otherwise.
+
+class PathOperationCancelled : public std::runtime_error
+{
+public:
+	PathOperationCancelled() : std::runtime_error("path operation has been cancelled.") {}
+};
+
+class PathAsyncJob;
+
+struct PathAsyncCancelCallback
+{
+	PathAsyncJob * job;
+	void operator()() const noexcept;
+};
+
+class PathAsyncJob
+{
+public:
+	enum State
+	{
+		State_Initial = 0,
+		State_Pending,
+		State_Running,
+		State_Finished,
+		State_Cancelled
+	};
+
+	std::atomic<int> state;
+	std::coroutine_handle<> continuation;
+	std::exception_ptr error;
+	std::optional<std::stop_callback<PathAsyncCancelCallback>> stopCallback;
+
+	PathAsyncJob() : state(State_Initial) {}
+	virtual ~PathAsyncJob() = default;
+
+	virtual void execute() = 0;
+
+	void rethrowIfFailed()
+	{
+		if (state.load() == State_Cancelled)
+			throw PathOperationCancelled();
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+	PathAsyncJob(const PathAsyncJob &) = delete;
+	PathAsyncJob & operator=(const PathAsyncJob &) = delete;
+};
+
+template <class T> class PathAsyncResultJob : public PathAsyncJob
+{
+public:
+	explicit PathAsyncResultJob(std::function<T()> function) : m_function(std::move(function)) {}
+
+	void execute() override { m_result.emplace(m_function()); }
+	T takeResult() { return std::move(*m_result); }
+
+private:
+	std::function<T()> m_function;
+	std::optional<T> m_result;
+};
+
+template <> class PathAsyncResultJob<void> : public PathAsyncJob
+{
+public:
+	explicit PathAsyncResultJob(std::function<void()> function) : m_function(std::move(function)) {}
+
+	void execute() override { m_function(); }
+	void takeResult() {}
+
+private:
+	std::function<void()> m_function;
+};
+
+bool pathAsyncSubmit(const std::shared_ptr<PathAsyncJob> & job, std::coroutine_handle<> continuation,
+	const std::stop_token & token);
+
+template <class T> class PathAsyncOperation
+{
+public:
+	PathAsyncOperation(std::function<T()> function, std::stop_token token)
+		: m_job(std::make_shared<PathAsyncResultJob<T>>(std::move(function))),
+		  m_token(std::move(token))
+	{
+	}
+
+	bool await_ready() const noexcept { return false; }
+	bool await_suspend(std::coroutine_handle<> continuation) { return pathAsyncSubmit(m_job, continuation, m_token); }
+
+	T await_resume()
+	{
+		m_job->rethrowIfFailed();
+		return m_job->takeResult();
+	}
+
+private:
+	std::shared_ptr<PathAsyncResultJob<T>> m_job;
+	std::stop_token m_token;
+};
+
+void pathSetAsyncConcurrency(size_t maxThreads);
+size_t pathGetAsyncConcurrency();
+void pathSetAsyncResumeHandler(std::function<void(std::coroutine_handle<>)> handler);
+
+template <class T> PathAsyncOperation<T> pathRunAsync(std::function<T()> function,
+	std::stop_token token = std::stop_token())
+{
+	return PathAsyncOperation<T>(std::move(function), std::move(token));
+}
+
+PathAsyncOperation<bool> pathIsFileAsync(const std::string & path, std::stop_token token = std::stop_token());
+PathAsyncOperation<bool> pathCreateAsync(const std::string & path, std::stop_token token = std::stop_token());
+PathAsyncOperation<std::string> pathMakeCanonicalAsync(const std::string & path,
+	std::stop_token token = std::stop_token());
+PathAsyncOperation<DirEntryList> pathEnumDirectoryContentsAsync(const std::string & path,
+	std::stop_token token = std::stop_token());
+PathAsyncOperation<void> pathDeleteFileAsync(const std::string & path, std::stop_token token = std::stop_token());
+
+#endif
+
+#endif
@@ -0,0 +1,688 @@
+/* vim: set ai noet ts=4 sw=4 tw=115: */
+//
+// Copyright (c) 2014 Nikolay Zapolnov (zapolnov@gmail.com).
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "path-util.h"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+ #include <unistd.h>
+#endif
+
+//
+// Allocation counting
+//
+
+static std::atomic<uint64_t> g_allocationCount(0);
+
+void * operator new(size_t size)
+{
+	g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+	void * p = malloc(size > 0 ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void * operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void * p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void * p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void * p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void * p, size_t) noexcept
+{
+	free(p);
+}
+
+#ifdef __cpp_aligned_new
+void * operator new(size_t size, std::align_val_t alignment)
+{
+	g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+	size_t align = static_cast<size_t>(alignment);
+	void * p = aligned_alloc(align, (size + align - 1) / align * align);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void * p, std::align_val_t) noexcept
+{
+	free(p);
+}
+
+void operator delete(void * p, size_t, std::align_val_t) noexcept
+{
+	free(p);
+}
+#endif
+
+//
+// Benchmark runner
+//
+
+struct BenchOptions
+{
+	std::string filter;
+	std::vector<size_t> treeSizes;
+	size_t stringRounds;
+	bool csv;
+};
+
+static volatile size_t g_sink;
+
+static void printHeader(const BenchOptions & options)
+{
+	if (options.csv)
+		printf("benchmark,ops,ns_per_op,ops_per_sec,allocs_per_op\n");
+	else
+	{
+		printf("%-44s %12s %12s %14s %12s\n", "benchmark", "ops", "ns/op", "ops/s", "allocs/op");
+		printf("%-44s %12s %12s %14s %12s\n", "---------", "---", "-----", "-----", "---------");
+	}
+}
+
+static void printResult(const BenchOptions & options, const std::string & name, uint64_t ops, double ns,
+	uint64_t allocs)
+{
+	double nsPerOp = (ops > 0 ? ns / static_cast<double>(ops) : 0.0);
+	double opsPerSec = (ns > 0.0 ? static_cast<double>(ops) * 1e9 / ns : 0.0);
+	double allocsPerOp = (ops > 0 ? static_cast<double>(allocs) / static_cast<double>(ops) : 0.0);
+
+	if (options.csv)
+	{
+		printf("%s,%llu,%.2f,%.0f,%.3f\n", name.c_str(), (unsigned long long)ops, nsPerOp, opsPerSec,
+			allocsPerOp);
+	}
+	else
+	{
+		printf("%-44s %12llu %12.2f %14.0f %12.3f\n", name.c_str(), (unsigned long long)ops, nsPerOp,
+			opsPerSec, allocsPerOp);
+	}
+	fflush(stdout);
+}
+
+// Runs the workload once to warm up caches and then `rounds` more times. The workload returns the number of
+// operations it has performed.
+static void runBenchmark(const BenchOptions & options, const std::string & name, size_t rounds,
+	const std::function<uint64_t()> & workload)
+{
+	if (options.filter.length() > 0 && name.find(options.filter) == std::string::npos)
+		return;
+
+	workload();
+
+	uint64_t ops = 0;
+	uint64_t allocsBefore = g_allocationCount.load(std::memory_order_relaxed);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < rounds; i++)
+		ops += workload();
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	uint64_t allocs = g_allocationCount.load(std::memory_order_relaxed) - allocsBefore;
+
+	double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+	printResult(options, name, ops, ns, allocs);
+}
+
+//
+// Path corpora
+//
+
+// xorshift64*, so that the synthetic corpus is identical on every run and every platform.
+class Random
+{
+public:
+	explicit Random(uint64_t seed) : m_state(seed) {}
+
+	uint64_t next()
+	{
+		m_state ^= m_state >> 12;
+		m_state ^= m_state << 25;
+		m_state ^= m_state >> 27;
+		return m_state * 2685821657736338717ULL;
+	}
+
+	size_t next(size_t limit) { return static_cast<size_t>(next() % limit); }
+
+private:
+	uint64_t m_state;
+};
+
+static std::string makeName(Random & random, size_t length)
+{
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789_-";
+	std::string name;
+	name.reserve(length);
+	for (size_t i = 0; i < length; i++)
+		name += chars[random.next(sizeof(chars) - 1)];
+	return name;
+}
+
+static std::vector<std::string> makeSyntheticCorpus(size_t count)
+{
+	Random random(0x9e3779b97f4a7c15ULL);
+	std::vector<std::string> corpus;
+	corpus.reserve(count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		std::string path;
+		if (random.next(2) == 0)
+			path = pathSeparator();
+
+		size_t depth = 1 + random.next(i % 8 == 0 ? 64 : 12);
+		for (size_t j = 0; j < depth; j++)
+		{
+			if (j > 0)
+				path += pathSeparator();
+
+			switch (random.next(10))
+			{
+			case 0: path += ".."; break;
+			case 1: path += "."; break;
+			case 2: path += pathSeparator(); path += makeName(random, 1 + random.next(8)); break;
+			case 3: path += makeName(random, 64 + random.next(192)); break;
+			default: path += makeName(random, 1 + random.next(16)); break;
+			}
+		}
+
+		if (random.next(3) == 0)
+			path += ".tar.gz";
+
+		corpus.push_back(path);
+	}
+
+	return corpus;
+}
+
+static std::vector<std::string> makeRealWorldCorpus()
+{
+	static const char * const paths[] = {
+		"/usr/lib/x86_64-linux-gnu/libstdc++.so.6",
+		"/usr/include/c++/12/bits/stl_algo.h",
+		"/usr/share/doc/libc6/changelog.Debian.gz",
+		"/etc/ssl/certs/ca-certificates.crt",
+		"/var/log/journal/0b5e8c1d3f/system@000612.journal",
+		"/home/user/.cache/pip/http/d/1/3/a/5/d13a5f0e9c2b.body",
+		"/home/user/src/project/build/../src/core/./module/file.cpp",
+		"/home/user/src/project/node_modules/@babel/core/node_modules/@babel/helpers/lib/index.js",
+		"/home/user/src/project/node_modules/.pnpm/react-dom@18.2.0/node_modules/react-dom/cjs/react-dom.development.js",
+		"~/Documents/Reports/2014/Q3/summary.final.v2.docx",
+		"~/.config/nvim/lua/plugins/../settings.lua",
+		"src/../include/./path-util.h",
+		"../../../third_party/boost/libs/filesystem/src/operations.cpp",
+		"./build/CMakeFiles/path-util.dir/path-util.cpp.o",
+		"build/Release/obj/x64/intermediate/generated/sources/a/b/c/d/e/f/g/h/output.pb.cc",
+		"/opt/toolchains/arm-none-eabi/lib/gcc/arm-none-eabi/10.3.1/thumb/v7e-m+fp/hard/libgcc.a",
+		"/srv/cache/objects/3f/3f2a8c1b9e7d6c5b4a3f2e1d0c9b8a7f6e5d4c3b",
+		"/tmp/build-7f3a/src/a/../b/../c/../d/file.txt",
+		"assets//textures//characters///hero_diffuse.png",
+		"/proc/self/fd/../exe",
+		"/mnt/data/datasets/imagenet/train/n01440764/n01440764_10026.JPEG",
+		"lib/python3.11/site-packages/numpy/core/_multiarray_umath.cpython-311-x86_64-linux-gnu.so",
+		"C:/Users/user/AppData/Local/Temp/build/output.log",
+		"docs/../README.md",
+		"a/b/c/d/e/f/g/h/i/j/k/l/m/n/o/p/q/r/s/t/u/v/w/x/y/z/../../../../../../file",
+	};
+
+	std::vector<std::string> corpus;
+	for (const char * path : paths)
+		corpus.push_back(pathToNativeSeparators(path));
+	return corpus;
+}
+
+static void runStringBenchmarks(const BenchOptions & options, const std::string & corpusName,
+	const std::vector<std::string> & corpus)
+{
+	const std::string base = pathToNativeSeparators("/home/user/src/project/build");
+	const size_t rounds = options.stringRounds;
+
+	runBenchmark(options, "pathSimplify/" + corpusName, rounds, [&corpus]() -> uint64_t {
+		for (const std::string & path : corpus)
+			g_sink = g_sink + pathSimplify(path).length();
+		return corpus.size();
+	});
+
+	runBenchmark(options, "pathConcat/" + corpusName, rounds, [&corpus]() -> uint64_t {
+		for (size_t i = 0; i < corpus.size(); i++)
+			g_sink = g_sink + pathConcat(corpus[i], corpus[(i + 1) % corpus.size()]).length();
+		return corpus.size();
+	});
+
+	runBenchmark(options, "pathMakeAbsolute(base)/" + corpusName, rounds, [&corpus, &base]() -> uint64_t {
+		for (const std::string & path : corpus)
+			g_sink = g_sink + pathMakeAbsolute(path, base).length();
+		return corpus.size();
+	});
+
+	runBenchmark(options, "pathMakeAbsolute(cwd)/" + corpusName, rounds, [&corpus]() -> uint64_t {
+		for (const std::string & path : corpus)
+			g_sink = g_sink + pathMakeAbsolute(path).length();
+		return corpus.size();
+	});
+
+  #ifdef PATH_UTIL_HAS_PMR
+	runBenchmark(options, "pathSimplify(pmr)/" + corpusName, rounds, [&corpus]() -> uint64_t {
+		// One arena per path, released after each one, like a per-request arena would be.
+		char buffer[4096];
+		std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer));
+		for (const std::string & path : corpus)
+		{
+			g_sink = g_sink + pathSimplify(path, &arena).length();
+			arena.release();
+		}
+		return corpus.size();
+	});
+
+	runBenchmark(options, "pathMakeAbsolute(base,pmr)/" + corpusName, rounds, [&corpus, &base]() -> uint64_t {
+		// One arena per path, released after each one, like a per-request arena would be.
+		char buffer[4096];
+		std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer));
+		for (const std::string & path : corpus)
+		{
+			g_sink = g_sink + pathMakeAbsolute(path, base, &arena).length();
+			arena.release();
+		}
+		return corpus.size();
+	});
+  #endif
+
+	runBenchmark(options, "pathMakeRelative/" + corpusName, rounds, [&corpus, &base]() -> uint64_t {
+		for (const std::string & path : corpus)
+			g_sink = g_sink + pathMakeRelative(path, base).length();
+		return corpus.size();
+	});
+
+	std::vector<std::string> roots;
+	for (size_t i = 0; i < corpus.size() && roots.size() < 100; i += 7)
+		roots.push_back(pathGetDirectory(pathSimplify(corpus[i])));
+	runBenchmark(options, "pathFindContainingRoots/" + corpusName, rounds, [&corpus, &roots]() -> uint64_t {
+		g_sink = g_sink + pathFindContainingRoots(corpus, roots).size();
+		return corpus.size();
+	});
+
+	runBenchmark(options, "pathGetDirectory/" + corpusName, rounds, [&corpus]() -> uint64_t {
+		for (const std::string & path : corpus)
+			g_sink = g_sink + pathGetDirectory(path).length();
+		return corpus.size();
+	});
+
+	runBenchmark(options, "pathReplaceFullFileExtension/" + corpusName, rounds, [&corpus]() -> uint64_t {
+		for (const std::string & path : corpus)
+			g_sink = g_sink + pathReplaceFullFileExtension(path, ".o").length();
+		return corpus.size();
+	});
+
+	// Join/strip loop: build an object file path under the build directory and walk back up to it.
+	runBenchmark(options, "joinStrip(string)/" + corpusName, rounds, [&corpus, &base]() -> uint64_t {
+		for (const std::string & path : corpus)
+		{
+			std::string file = pathReplaceFullFileExtension(pathConcat(base, pathGetFileName(path)), ".o");
+			g_sink = g_sink + pathGetDirectory(file).length();
+		}
+		return corpus.size();
+	});
+
+	runBenchmark(options, "joinStrip(PathBuf)/" + corpusName, rounds, [&corpus, &base]() -> uint64_t {
+		PathBuf<256> file;
+		for (const std::string & path : corpus)
+		{
+			size_t nameOffset = pathIndexOfFileName(path.data(), path.length());
+			file.assign(base.data(), base.length());
+			file.appendComponent(path.data() + nameOffset, path.length() - nameOffset);
+			file.replaceFullFileExtension(".o");
+			g_sink = g_sink + file.popComponent().length();
+		}
+		return corpus.size();
+	});
+}
+
+//
+// File system workloads
+//
+
+#ifndef _WIN32
+
+static const size_t FilesPerDirectory = 100;
+
+static std::string makeTempDirectory()
+{
+	const char * tmp = getenv("TMPDIR");
+	std::string pattern = pathConcat(tmp && *tmp ? tmp : "/tmp", "path-util-bench.XXXXXX");
+	std::vector<char> buf(pattern.begin(), pattern.end());
+	buf.push_back(0);
+	if (!mkdtemp(buf.data()))
+	{
+		int err = errno;
+		std::stringstream ss;
+		ss << "unable to create temporary directory '" << pattern << "': " << strerror(err);
+		throw std::runtime_error(ss.str());
+	}
+	return buf.data();
+}
+
+// Generates a two-level tree with `entries` files spread over directories of FilesPerDirectory files each.
+static std::vector<std::string> generateTree(const std::string & root, size_t entries)
+{
+	std::vector<std::string> dirs;
+	size_t dirCount = (entries + FilesPerDirectory - 1) / FilesPerDirectory;
+	size_t created = 0;
+
+	for (size_t i = 0; i < dirCount; i++)
+	{
+		std::stringstream ss;
+		ss << "d" << (i / FilesPerDirectory) << pathSeparator() << "d" << i;
+		std::string dir = pathConcat(root, ss.str());
+		pathCreate(dir);
+		dirs.push_back(dir);
+
+		for (size_t j = 0; j < FilesPerDirectory && created < entries; j++, created++)
+		{
+			std::stringstream name;
+			name << "file" << j << ".dat";
+			std::string file = pathConcat(dir, name.str());
+			FILE * f = fopen(file.c_str(), "wb");
+			if (!f)
+			{
+				int err = errno;
+				std::stringstream ss;
+				ss << "unable to create file '" << file << "': " << strerror(err);
+				throw std::runtime_error(ss.str());
+			}
+			fclose(f);
+		}
+	}
+
+	return dirs;
+}
+
+static void deleteTree(const std::string & path)
+{
+	DirEntryList entries = pathEnumDirectoryContents(path);
+	for (const DirEntry & entry : entries)
+	{
+		std::string child = pathConcat(path, entry.name);
+		if (entry.type == DirEntry_Directory)
+			deleteTree(child);
+		else
+			pathDeleteFile(child);
+	}
+	rmdir(path.c_str());
+}
+
+// Evicts the page, dentry and inode caches. Only possible when running as root on Linux.
+static bool dropCaches()
+{
+  #ifdef __linux__
+	sync();
+	FILE * f = fopen("/proc/sys/vm/drop_caches", "w");
+	if (!f)
+		return false;
+	bool ok = (fputs("3", f) >= 0);
+	return (fclose(f) == 0 && ok);
+  #else
+	return false;
+  #endif
+}
+
+static void runFileSystemBenchmarks(const BenchOptions & options, size_t entries)
+{
+	std::string root = makeTempDirectory();
+
+	try
+	{
+		std::vector<std::string> dirs = generateTree(root, entries);
+		std::vector<std::string> files;
+		for (const std::string & dir : dirs)
+		{
+			for (size_t j = 0; j < FilesPerDirectory && files.size() < entries; j++)
+			{
+				std::stringstream name;
+				name << "file" << j << ".dat";
+				files.push_back(pathConcat(dir, name.str()));
+			}
+		}
+
+		std::stringstream suffix;
+		suffix << "/" << entries;
+
+		std::function<uint64_t()> enumerate = [&dirs]() -> uint64_t {
+			uint64_t count = 0;
+			for (const std::string & dir : dirs)
+				count += pathEnumDirectoryContents(dir).size();
+			return count;
+		};
+
+		std::function<uint64_t()> isFile = [&files]() -> uint64_t {
+			for (const std::string & file : files)
+				g_sink = g_sink + (pathIsFile(file) ? 1 : 0);
+			return files.size();
+		};
+
+		std::function<uint64_t()> makeCanonical = [&files]() -> uint64_t {
+			for (const std::string & file : files)
+				g_sink = g_sink + pathMakeCanonical(file).length();
+			return files.size();
+		};
+
+		std::function<uint64_t()> diskUsage = [&root]() -> uint64_t {
+			DiskUsage usage = pathDiskUsage(root);
+			return usage.total.files + usage.total.directories;
+		};
+
+		runBenchmark(options, "pathEnumDirectoryContents/hot" + suffix.str(), 3, enumerate);
+		runBenchmark(options, "pathDiskUsage/hot" + suffix.str(), 3, diskUsage);
+		runBenchmark(options, "pathIsFile/hot" + suffix.str(), 3, isFile);
+		runBenchmark(options, "pathMakeCanonical/hot" + suffix.str(), 3, makeCanonical);
+
+		// Cold runs must not be warmed up, so they bypass runBenchmark's warm-up pass.
+		std::string coldNames[] = {
+			"pathEnumDirectoryContents/cold" + suffix.str(),
+			"pathIsFile/cold" + suffix.str(),
+			"pathDiskUsage/cold" + suffix.str(),
+		};
+		std::function<uint64_t()> coldWorkloads[] = { enumerate, isFile, diskUsage };
+		for (size_t i = 0; i < 3; i++)
+		{
+			if (options.filter.length() > 0 && coldNames[i].find(options.filter) == std::string::npos)
+				continue;
+			if (!dropCaches())
+			{
+				if (!options.csv)
+					printf("%-44s (skipped: dropping caches requires root on Linux)\n", coldNames[i].c_str());
+				continue;
+			}
+			uint64_t allocsBefore = g_allocationCount.load(std::memory_order_relaxed);
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			uint64_t ops = coldWorkloads[i]();
+			std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+			uint64_t allocs = g_allocationCount.load(std::memory_order_relaxed) - allocsBefore;
+			double ns = static_cast<double>(
+				std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+			printResult(options, coldNames[i], ops, ns, allocs);
+		}
+	}
+	catch (...)
+	{
+		deleteTree(root);
+		throw;
+	}
+
+	deleteTree(root);
+}
+
+// Atomic writes of `count` 4 KiB files into one directory, as a single batch and one file at a time.
+static void runWriteBenchmarks(const BenchOptions & options, size_t count)
+{
+	std::string root = makeTempDirectory();
+
+	try
+	{
+		std::string data(4096, 'x');
+		FileWriteRequestList files(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			std::stringstream name;
+			name << "file" << i << ".dat";
+			files[i].path = pathConcat(root, name.str());
+			files[i].data = data.data();
+			files[i].size = data.size();
+		}
+
+		std::stringstream suffix;
+		suffix << "/" << count;
+
+		runBenchmark(options, "pathWriteFilesAtomic(batch)" + suffix.str(), 3, [&files]() -> uint64_t {
+			pathWriteFilesAtomic(files);
+			return files.size();
+		});
+
+		runBenchmark(options, "pathWriteFileAtomic(each)" + suffix.str(), 3, [&files]() -> uint64_t {
+			for (const FileWriteRequest & file : files)
+				pathWriteFileAtomic(file.path, file.data, file.size);
+			return files.size();
+		});
+	}
+	catch (...)
+	{
+		deleteTree(root);
+		throw;
+	}
+
+	deleteTree(root);
+}
+
+#endif
+
+//
+// Entry point
+//
+
+static void printUsage(const char * argv0)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  --filter <text>       run only benchmarks whose name contains <text>\n"
+		"  --rounds <n>          number of measured rounds for string benchmarks (default 20)\n"
+		"  --tree-size <n>       file system tree size in entries; may be repeated (default 1000 10000 100000)\n"
+		"  --large               also run the file system benchmarks on a 1000000-entry tree\n"
+		"  --no-fs               skip file system benchmarks\n"
+		"  --csv                 produce machine-readable output\n",
+		argv0);
+}
+
+int main(int argc, char ** argv)
+{
+	BenchOptions options;
+	options.stringRounds = 20;
+	options.csv = false;
+	bool fs = true;
+	bool large = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--filter" && i + 1 < argc)
+			options.filter = argv[++i];
+		else if (arg == "--rounds" && i + 1 < argc)
+			options.stringRounds = static_cast<size_t>(strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--tree-size" && i + 1 < argc)
+			options.treeSizes.push_back(static_cast<size_t>(strtoul(argv[++i], nullptr, 10)));
+		else if (arg == "--large")
+			large = true;
+		else if (arg == "--no-fs")
+			fs = false;
+		else if (arg == "--csv")
+			options.csv = true;
+		else
+		{
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (options.treeSizes.empty())
+	{
+		options.treeSizes.push_back(1000);
+		options.treeSizes.push_back(10000);
+		options.treeSizes.push_back(100000);
+	}
+	if (large)
+		options.treeSizes.push_back(1000000);
+
+  #ifndef NDEBUG
+	fprintf(stderr, "warning: benchmark was built with assertions enabled; use a Release build for real numbers.\n");
+  #endif
+
+	try
+	{
+		printHeader(options);
+
+		runStringBenchmarks(options, "synthetic", makeSyntheticCorpus(10000));
+		runStringBenchmarks(options, "real-world", makeRealWorldCorpus());
+
+		if (fs)
+		{
+		  #ifndef _WIN32
+			for (size_t entries : options.treeSizes)
+				runFileSystemBenchmarks(options, entries);
+			runWriteBenchmarks(options, 100);
+			runWriteBenchmarks(options, 1000);
+		  #else
+			fprintf(stderr, "file system benchmarks are not implemented on this platform.\n");
+		  #endif
+		}
+	}
+	catch (const std::exception & e)
+	{
+		fprintf(stderr, "error: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,1265 @@
+/* vim: set ai noet ts=4 sw=4 tw=115: */
+//
+// Copyright (c) 2014 Nikolay Zapolnov (zapolnov@gmail.com).
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "path-util.h"
+#include "path-util-async.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+ #include <cerrno>
+ #include <cstring>
+ #include <fcntl.h>
+ #include <sys/resource.h>
+ #include <sys/stat.h>
+ #include <unistd.h>
+#endif
+
+#ifdef __linux__
+ #include <sys/mount.h>
+#endif
+
+#ifdef PATH_UTIL_HAS_COROUTINES
+ #include <chrono>
+ #include <deque>
+ #include <mutex>
+#endif
+
+// Consistency checks for the library, run by ctest. The expected values in the tables below were produced by the
+// original implementation of these functions, so that rewrites of the string algorithms can't change behaviour
+// unnoticed.
+
+//
+// Allocation counting
+//
+
+static std::atomic<uint64_t> g_allocationCount(0);
+
+// Kept out of line so GCC can't see malloc() and free() through the replaced
+// operators and raise a false -Wmismatched-new-delete.
+#if defined(__GNUC__) || defined(__clang__)
+  #define PATH_UTIL_CHECK_NOINLINE __attribute__((noinline))
+#else
+  #define PATH_UTIL_CHECK_NOINLINE
+#endif
+
+PATH_UTIL_CHECK_NOINLINE void * operator new(size_t size)
+{
+	g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+	void * p = malloc(size > 0 ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void * operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+PATH_UTIL_CHECK_NOINLINE void operator delete(void * p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void * p) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete(void * p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete[](void * p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+//
+// Check helpers
+//
+
+static size_t g_checks;
+static size_t g_failures;
+
+static void checkEqual(const std::string & what, const std::string & actual, const std::string & expected)
+{
+	++g_checks;
+	if (actual != expected)
+	{
+		++g_failures;
+		fprintf(stderr, "FAIL: %s: got \"%s\", expected \"%s\"\n", what.c_str(), actual.c_str(), expected.c_str());
+	}
+}
+
+static void checkEqual(const std::string & what, size_t actual, size_t expected)
+{
+	checkEqual(what, std::to_string(actual), std::to_string(expected));
+}
+
+static void checkTrue(const std::string & what, bool value)
+{
+	++g_checks;
+	if (!value)
+	{
+		++g_failures;
+		fprintf(stderr, "FAIL: %s\n", what.c_str());
+	}
+}
+
+template <class Function> static void checkThrows(const std::string & what, Function function)
+{
+	++g_checks;
+	try
+	{
+		function();
+	}
+	catch (const std::exception &)
+	{
+		return;
+	}
+	++g_failures;
+	fprintf(stderr, "FAIL: %s: no exception\n", what.c_str());
+}
+
+//
+// String functions
+//
+
+#ifndef _WIN32
+
+struct StringCase
+{
+	const char * path;
+	const char * simplified;
+	const char * concat;			// pathConcat(path, "x/y")
+	const char * directory;
+	const char * fileName;
+	const char * shortExtension;
+	const char * fullExtension;
+	const char * replacedExtension;	// pathReplaceFullFileExtension(path, ".o")
+	size_t fileNameIndex;
+};
+
+static const StringCase g_stringCases[] = {
+	{ "", "", "x/y", "", "", "", "", ".o", 0 },
+	{ ".", ".", "./x/y", "", ".", ".", ".", ".o", 0 },
+	{ "..", "..", "../x/y", "", "..", ".", "..", ".o", 0 },
+	{ "/", "/", "/x/y", "", "", "", "", "/.o", 1 },
+	{ "//", "/", "//x/y", "/", "", "", "", "//.o", 2 },
+	{ "a", "a", "a/x/y", "", "a", "", "", "a.o", 0 },
+	{ "a/", "a", "a/x/y", "a", "", "", "", "a/.o", 2 },
+	{ "/a/b/../c", "/a/c", "/a/b/../c/x/y", "/a/b/..", "c", "", "", "/a/b/../c.o", 8 },
+	{ "a/./b//c/", "a/b/c", "a/./b//c/x/y", "a/./b//c", "", "", "", "a/./b//c/.o", 9 },
+	{ "../../a", "../../a", "../../a/x/y", "../..", "a", "", "", "../../a.o", 6 },
+	{ "a/../..", "..", "a/../../x/y", "a/..", "..", ".", "..", "a/../.o", 5 },
+	{ "a/b/../../..", "..", "a/b/../../../x/y", "a/b/../..", "..", ".", "..", "a/b/../../.o", 10 },
+	{ "~", "~", "~/x/y", "", "~", "", "", "~.o", 0 },
+	{ "~/", "~/", "~/x/y", "~", "", "", "", "~/.o", 2 },
+	{ "~/a/../b", "~/b", "~/a/../b/x/y", "~/a/..", "b", "", "", "~/a/../b.o", 7 },
+	{ "~user/x", "~user/x", "~user/x/x/y", "~user", "x", "", "", "~user/x.o", 6 },
+	{ "/a/b.c.d", "/a/b.c.d", "/a/b.c.d/x/y", "/a", "b.c.d", ".d", ".c.d", "/a/b.o", 3 },
+	{ "a.b/c", "a.b/c", "a.b/c/x/y", "a.b", "c", "", "", "a.b/c.o", 4 },
+	{ ".hidden", ".hidden", ".hidden/x/y", "", ".hidden", ".hidden", ".hidden", ".o", 0 },
+	{ "dir/.x.y", "dir/.x.y", "dir/.x.y/x/y", "dir", ".x.y", ".y", ".x.y", "dir/.o", 4 },
+	{ "a/b/", "a/b", "a/b/x/y", "a/b", "", "", "", "a/b/.o", 4 },
+	{ "/../a", "/../a", "/../a/x/y", "/..", "a", "", "", "/../a.o", 4 },
+	{ "./a/./", "a", "./a/./x/y", "./a/.", "", "", "", "./a/./.o", 6 },
+	{ "a//b", "a/b", "a//b/x/y", "a/", "b", "", "", "a//b.o", 3 },
+	{ "x.tar.gz", "x.tar.gz", "x.tar.gz/x/y", "", "x.tar.gz", ".gz", ".tar.gz", "x.o", 0 },
+	{ "/usr/lib/libfoo.so.1", "/usr/lib/libfoo.so.1", "/usr/lib/libfoo.so.1/x/y", "/usr/lib", "libfoo.so.1", ".1", ".so.1", "/usr/lib/libfoo.o", 9 },
+	{ "/a/./b/./c/..", "/a/b/c/..", "/a/./b/./c/../x/y", "/a/./b/./c", "..", ".", "..", "/a/./b/./c/.o", 11 },
+	{ "a/b.c/", "a/b.c", "a/b.c/x/y", "a/b.c", "", "", "", "a/b.c/.o", 6 },
+};
+
+struct AbsoluteCase
+{
+	const char * path;
+	const char * absolute;			// pathMakeAbsolute(path, "/base/dir")
+};
+
+static const AbsoluteCase g_absoluteCases[] = {
+	{ "", "/base/dir" },
+	{ ".", "/base/dir/." },
+	{ "..", "/base/dir/.." },
+	{ "/", "/" },
+	{ "//", "/" },
+	{ "a", "/base/dir/a" },
+	{ "a/", "/base/dir/a" },
+	{ "/a/b/../c", "/a/c" },
+	{ "a/./b//c/", "/base/dir/a/b/c" },
+	{ "../../a", "/a" },
+	{ "a/../..", "/base/dir/.." },
+	{ "a/b/../../..", "/base/dir/.." },
+	{ "/a/b.c.d", "/a/b.c.d" },
+	{ "a.b/c", "/base/dir/a.b/c" },
+	{ ".hidden", "/base/dir/.hidden" },
+	{ "dir/.x.y", "/base/dir/dir/.x.y" },
+	{ "a/b/", "/base/dir/a/b" },
+	{ "/../a", "/../a" },
+	{ "./a/./", "/base/dir/a" },
+	{ "a//b", "/base/dir/a/b" },
+	{ "x.tar.gz", "/base/dir/x.tar.gz" },
+	{ "/usr/lib/libfoo.so.1", "/usr/lib/libfoo.so.1" },
+	{ "/a/./b/./c/..", "/a/b/c/.." },
+	{ "a/b.c/", "/base/dir/a/b.c" },
+	{ "~", "/home/path-util-check-user" },
+	{ "~/", "/home/path-util-check-user" },
+	{ "~/a/../b", "/home/path-util-check-user/b" },
+	{ "~user/x", "/base/dir/~user/x" },
+};
+
+// PathBuf<4> has to spill to the heap for most of the table, PathBuf<256> never does.
+template <size_t N> static void checkPathBuf(const StringCase & c)
+{
+	std::string what = "PathBuf<" + std::to_string(N) + ">(\"" + c.path + "\")";
+	checkEqual(what + ".appendComponent()", PathBuf<N>(c.path).appendComponent("x/y").str(), c.concat);
+	checkEqual(what + ".popComponent()", PathBuf<N>(c.path).popComponent().str(), c.directory);
+	checkEqual(what + ".replaceFullFileExtension()", PathBuf<N>(c.path).replaceFullFileExtension(".o").str(),
+		c.replacedExtension);
+}
+
+// Copies and moves out of an inline and out of a heap buffer, and components appended from the buffer itself.
+template <size_t N> static void checkPathBufOwnership()
+{
+	std::string prefix = "PathBuf<" + std::to_string(N) + "> ";
+	std::string shortPath = "a/b";
+	std::string longPath = "dir";
+	while (longPath.length() <= N)
+		longPath += "/dir";
+
+	for (const std::string & path : { shortPath, longPath })
+	{
+		bool heap = (path.length() > N);
+		std::string what = prefix + (heap ? "heap " : "inline ");
+
+		PathBuf<N> source(path);
+		checkTrue(what + "source storage", source.isInline() != heap);
+
+		PathBuf<N> copy(source);
+		checkEqual(what + "copy", copy.str(), path);
+		checkEqual(what + "source after copy", source.str(), path);
+
+		PathBuf<N> assigned("x");
+		assigned = source;
+		checkEqual(what + "copy assignment", assigned.str(), path);
+
+		uint64_t allocations = g_allocationCount.load();
+		PathBuf<N> moved(std::move(source));
+		checkEqual(what + "allocations of a move", static_cast<size_t>(g_allocationCount.load() - allocations), 0);
+		checkEqual(what + "move", moved.str(), path);
+		checkTrue(what + "storage after move", moved.isInline() != heap);
+		if (heap)
+		{
+			checkTrue(what + "source after move is empty", source.empty() && source.isInline());
+			checkEqual(what + "source after move", source.c_str(), "");
+		}
+
+		PathBuf<N> moveAssigned(longPath);
+		moveAssigned = std::move(moved);
+		checkEqual(what + "move assignment", moveAssigned.str(), path);
+		PathBuf<N> & self = moveAssigned;
+		moveAssigned = std::move(self);
+		checkEqual(what + "self move assignment", moveAssigned.str(), path);
+
+		source = moveAssigned;
+		source.appendComponent(source.c_str(), source.length());
+		checkEqual(what + "component appended from itself", source.str(), pathConcat(path, path));
+		source.appendComponent(source.c_str() + path.length() + 1, path.length());
+		checkEqual(what + "component appended from its own tail", source.str(),
+			pathConcat(pathConcat(path, path), path));
+	}
+}
+
+static void checkStringFunctions()
+{
+	for (const StringCase & c : g_stringCases)
+	{
+		std::string path = c.path;
+		checkEqual("pathSimplify(\"" + path + "\")", pathSimplify(path), c.simplified);
+		checkEqual("pathConcat(\"" + path + "\")", pathConcat(path, "x/y"), c.concat);
+		checkEqual("pathGetDirectory(\"" + path + "\")", pathGetDirectory(path), c.directory);
+		checkEqual("pathGetFileName(\"" + path + "\")", pathGetFileName(path), c.fileName);
+		checkEqual("pathGetShortFileExtension(\"" + path + "\")", pathGetShortFileExtension(path), c.shortExtension);
+		checkEqual("pathGetFullFileExtension(\"" + path + "\")", pathGetFullFileExtension(path), c.fullExtension);
+		checkEqual("pathReplaceFullFileExtension(\"" + path + "\")", pathReplaceFullFileExtension(path, ".o"),
+			c.replacedExtension);
+		checkEqual("pathIndexOfFileName(\"" + path + "\")", pathIndexOfFileName(path), c.fileNameIndex);
+		checkPathBuf<4>(c);
+		checkPathBuf<256>(c);
+	}
+
+	checkPathBufOwnership<4>();
+	checkPathBufOwnership<256>();
+
+	for (const AbsoluteCase & c : g_absoluteCases)
+	{
+		std::string path = c.path;
+		checkEqual("pathMakeAbsolute(\"" + path + "\")", pathMakeAbsolute(path, "/base/dir"), c.absolute);
+	}
+}
+
+//
+// Relative paths and containing roots
+//
+
+struct RelativeCase
+{
+	const char * path;
+	const char * basePath;
+	const char * relative;
+};
+
+static const RelativeCase g_relativeCases[] = {
+	{ "/a/b/c", "/a", "b/c" },
+	{ "/a", "/a/b/c", "../.." },
+	{ "/a/x", "/a/b/c", "../../x" },
+	{ "/a/b", "/a/b", "." },
+	{ "/a/./b//c/", "/a/b", "c" },
+	{ "a", "b/c", "../../a" },
+	{ "../x", "..", "x" },
+	{ "a/b", "", "a/b" },
+	{ "", "", "." },
+	// "~" and "~/" are the same root.
+	{ "~/src", "~", "src" },
+	{ "~", "~/", "." },
+	{ "~/a", "~/b", "../a" },
+	// Paths with different roots are returned unchanged.
+	{ "/a/b", "a", "/a/b" },
+	{ "a/b", "/a", "a/b" },
+	{ "~/a", "/home", "~/a" },
+};
+
+struct IsUnderCase
+{
+	const char * path;
+	const char * dir;
+	bool isUnder;
+};
+
+static const IsUnderCase g_isUnderCases[] = {
+	{ "/a/b", "/a", true },
+	{ "/a", "/a", true },
+	{ "/a/b", "/a/", true },
+	{ "/ab", "/a", false },
+	{ "a/./b", "a/b", true },
+	{ "~/x", "~", true },
+	{ "~", "~/", true },
+	// An empty directory contains every relative path, but no absolute ones.
+	{ "a", "", true },
+	{ "/a", "", false },
+	// ".." is not resolved.
+	{ "/a/../b", "/a", true },
+};
+
+static void checkRelativePaths()
+{
+	for (const RelativeCase & c : g_relativeCases)
+	{
+		std::string desc = "pathMakeRelative(\"" + std::string(c.path) + "\", \"" + c.basePath + "\")";
+		checkEqual(desc, pathMakeRelative(c.path, c.basePath), c.relative);
+	}
+
+	// A ".." left in the base path after the common prefix can't be undone lexically.
+	checkThrows("pathMakeRelative(\"/a/b\", \"/a/../c\")", []() { pathMakeRelative("/a/b", "/a/../c"); });
+	checkThrows("pathMakeRelative(\"x\", \"..\")", []() { pathMakeRelative("x", ".."); });
+
+	for (const IsUnderCase & c : g_isUnderCases)
+	{
+		std::string desc = "pathIsUnder(\"" + std::string(c.path) + "\", \"" + c.dir + "\")";
+		checkTrue(desc, pathIsUnder(c.path, c.dir) == c.isUnder);
+	}
+
+	checkEqual("pathCommonPrefixLength(\"/a/b\", \"/a/c\")", pathCommonPrefixLength("/a/b", "/a/c"), 2);
+	checkEqual("pathCommonPrefixLength(\"/ab\", \"/a\")", pathCommonPrefixLength("/ab", "/a"), 1);
+	checkEqual("pathCommonPrefix(siblings)", pathCommonPrefix({ "/a/b/c", "/a/b/d", "/a/bc" }), "/a");
+	checkEqual("pathCommonPrefix(nested)", pathCommonPrefix({ "/a/b/c", "/a/b/c/d" }), "/a/b/c");
+	checkEqual("pathCommonPrefix(disjoint)", pathCommonPrefix({ "a/b", "c" }), "");
+	checkEqual("pathCommonPrefix(empty)", pathCommonPrefix({}), "");
+
+	const std::vector<std::string> roots = { "/a", "/a/b", "", "/a/b/", "~" };
+	const std::vector<std::string> paths = { "/a/b/c", "/a/x", "/z", "rel/p", "~/q", "/a/b", "/a" };
+	// The deepest root wins, and of equally deep ones ("/a/b" and "/a/b/") the one with the lowest index. The empty
+	// root matches every relative path.
+	const size_t expected[] = { 1, 0, std::string::npos, 2, 4, 1, 0 };
+	std::vector<size_t> result = pathFindContainingRoots(paths, roots);
+	checkEqual("pathFindContainingRoots().size()", result.size(), paths.size());
+	for (size_t i = 0; i < result.size() && i < paths.size(); i++)
+		checkEqual("pathFindContainingRoots(\"" + paths[i] + "\")", result[i], expected[i]);
+
+	result = pathFindContainingRoots(paths, std::vector<std::string>());
+	for (size_t i = 0; i < result.size(); i++)
+		checkEqual("pathFindContainingRoots(\"" + paths[i] + "\", no roots)", result[i], std::string::npos);
+}
+
+//
+// File system helpers
+//
+
+static std::string makeTempDirectory()
+{
+	const char * tmp = getenv("TMPDIR");
+	std::string pattern = pathConcat(tmp && *tmp ? tmp : "/tmp", "path-util-check.XXXXXX");
+	std::vector<char> buf(pattern.begin(), pattern.end());
+	buf.push_back(0);
+	if (!mkdtemp(buf.data()))
+	{
+		int err = errno;
+		std::stringstream ss;
+		ss << "unable to create temporary directory '" << pattern << "': " << strerror(err);
+		throw std::runtime_error(ss.str());
+	}
+	return buf.data();
+}
+
+static void deleteTree(const std::string & path)
+{
+	DirEntryList entries = pathEnumDirectoryContents(path);
+	for (const DirEntry & entry : entries)
+	{
+		std::string child = pathConcat(path, entry.name);
+		if (entry.type == DirEntry_Directory)
+			deleteTree(child);
+		else
+			pathDeleteFile(child);
+	}
+	rmdir(path.c_str());
+}
+
+static std::string readFile(const std::string & path)
+{
+	std::string data;
+	FILE * f = fopen(path.c_str(), "rb");
+	if (!f)
+		return data;
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		data.append(buf, n);
+	fclose(f);
+	return data;
+}
+
+static std::string makeFileName(const std::string & dir, const char * prefix, size_t index)
+{
+	std::stringstream ss;
+	ss << prefix << index;
+	return pathConcat(dir, ss.str());
+}
+
+//
+// Atomic writes
+//
+
+// Larger than the number of files pathWriteFilesAtomic() keeps open at a time.
+static const size_t LargeWriteBatch = 200;
+
+static void checkAtomicWrites(const std::string & root)
+{
+	std::string data = "contents";
+	FileWriteRequestList files(LargeWriteBatch);
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		files[i].path = makeFileName(root, "file", i);
+		files[i].data = data.data();
+		files[i].size = data.size();
+	}
+
+	// A batch larger than the descriptor limit succeeds.
+	struct rlimit limit;
+	getrlimit(RLIMIT_NOFILE, &limit);
+	struct rlimit lowered = limit;
+	lowered.rlim_cur = 128;
+	setrlimit(RLIMIT_NOFILE, &lowered);
+	try
+	{
+		pathWriteFilesAtomic(files);
+		checkTrue("pathWriteFilesAtomic() with a lowered descriptor limit", true);
+	}
+	catch (const std::exception & e)
+	{
+		checkTrue(std::string("pathWriteFilesAtomic() with a lowered descriptor limit: ") + e.what(), false);
+	}
+	setrlimit(RLIMIT_NOFILE, &limit);
+
+	for (const FileWriteRequest & file : files)
+		checkEqual("contents of '" + file.path + "'", readFile(file.path), data);
+
+	// A failure in a later group leaves no temporary files behind, and renames nothing.
+	std::string failDir = pathConcat(root, "fail");
+	pathCreate(failDir);
+	for (size_t i = 0; i < files.size(); i++)
+		files[i].path = makeFileName(failDir, "file", i);
+	files[files.size() - 10].path = pathConcat(failDir, "missing/file");
+	checkThrows("pathWriteFilesAtomic() into a missing directory", [&files]() { pathWriteFilesAtomic(files); });
+	checkEqual("files left after a failed batch", pathEnumDirectoryContents(failDir).size(), 0);
+
+	// Relative paths are written and synced relative to the current directory.
+	std::vector<char> cwd(4096);
+	if (getcwd(cwd.data(), cwd.size()) && chdir(root.c_str()) == 0)
+	{
+		try
+		{
+			pathWriteFileAtomic("relative", data);
+			checkTrue("pathWriteFileAtomic() with a relative path", true);
+		}
+		catch (const std::exception & e)
+		{
+			checkTrue(std::string("pathWriteFileAtomic() with a relative path: ") + e.what(), false);
+		}
+		if (chdir(cwd.data()) != 0)
+			throw std::runtime_error("unable to restore the current directory.");
+		checkEqual("contents of 'relative'", readFile(pathConcat(root, "relative")), data);
+	}
+
+	// A replaced file keeps its permissions; a new one is created according to the umask.
+	std::string privateFile = pathConcat(root, "private");
+	pathWriteFileAtomic(privateFile, data);
+	chmod(privateFile.c_str(), 0600);
+	pathWriteFileAtomic(privateFile, "new contents");
+	mode_t oldMask = umask(002);
+	std::string newFile = pathConcat(root, "new");
+	pathWriteFileAtomic(newFile, data);
+	umask(oldMask);
+
+	struct stat st;
+	checkTrue("stat of a replaced file", stat(privateFile.c_str(), &st) == 0);
+	checkEqual("permissions of a replaced file", st.st_mode & 07777, 0600);
+	checkTrue("stat of a new file", stat(newFile.c_str(), &st) == 0);
+	checkEqual("permissions of a new file", st.st_mode & 07777, 0664);
+	checkEqual("contents of a replaced file", readFile(privateFile), "new contents");
+}
+
+//
+// Disk usage
+//
+
+// Every directory of the tree built by makeDiskUsageTree(), in the order pathDiskUsage() returns them. The byte
+// counts only cover files; the sizes of the directories themselves depend on the file system and are added in
+// by checkDiskUsage().
+struct DiskUsageCase
+{
+	const char * path;
+	uint64_t files;
+	uint64_t directories;
+	uint64_t fileBytes;
+};
+
+static const DiskUsageCase g_diskUsageCases[] = {
+	{ "",      7, 4, 4360 },
+	{ "a",     4, 2, 1310 },
+	{ "a/b",   2, 1, 1010 },
+	{ "a/b/c", 0, 0, 0 },
+	{ "d",     3, 0, 3050 },
+};
+
+static void writeFileOfSize(const std::string & path, size_t size)
+{
+	pathWriteFileAtomic(path, std::string(size, 'x'));
+}
+
+static void setAccessTime(const std::string & path, time_t atime)
+{
+	struct timespec times[2];
+	times[0].tv_sec = atime;
+	times[0].tv_nsec = 0;
+	times[1].tv_sec = 0;
+	times[1].tv_nsec = UTIME_OMIT;
+	if (utimensat(AT_FDCWD, path.c_str(), times, 0) < 0)
+	{
+		int err = errno;
+		std::stringstream ss;
+		ss << "unable to set access time of '" << path << "': " << strerror(err);
+		throw std::runtime_error(ss.str());
+	}
+}
+
+static void makeDiskUsageTree(const std::string & root)
+{
+	pathCreate(pathConcat(root, "a/b/c"));
+	pathCreate(pathConcat(root, "d"));
+	writeFileOfSize(pathConcat(root, "a/a1.dat"), 100);
+	writeFileOfSize(pathConcat(root, "a/a2.dat"), 200);
+	writeFileOfSize(pathConcat(root, "a/b/b1.dat"), 1000);
+	writeFileOfSize(pathConcat(root, "a/b/b2.dat"), 10);
+	writeFileOfSize(pathConcat(root, "d/d1.dat"), 50);
+	writeFileOfSize(pathConcat(root, "d/d2.dat"), 3000);
+
+	// Both names of the hard link live in the same directory, so that the per-directory totals don't depend on
+	// which of them is seen first.
+	if (link(pathConcat(root, "a/a1.dat").c_str(), pathConcat(root, "a/a1.link").c_str()) < 0)
+		throw std::runtime_error("unable to create hard link.");
+
+	// A symlink to a directory counts as a file of its own and is not followed.
+	std::string target = "../a";
+	if (symlink(target.c_str(), pathConcat(root, "d/a.link").c_str()) < 0)
+		throw std::runtime_error("unable to create symlink.");
+}
+
+static uint64_t lstatSize(const std::string & path)
+{
+	struct stat st;
+	if (lstat(path.c_str(), &st) < 0)
+		throw std::runtime_error("unable to stat '" + path + "'.");
+	return static_cast<uint64_t>(st.st_size);
+}
+
+static bool isSameOrUnder(const std::string & path, const std::string & dir)
+{
+	return dir.empty() || path == dir || (path.compare(0, dir.length(), dir) == 0 && path[dir.length()] == '/');
+}
+
+static void checkDiskUsage(const std::string & root)
+{
+	makeDiskUsageTree(root);
+
+	// Symlink and directory sizes depend on the file system; the symlink is in "d".
+	uint64_t linkBytes = lstatSize(pathConcat(root, "d/a.link"));
+
+	const size_t caseCount = sizeof(g_diskUsageCases) / sizeof(g_diskUsageCases[0]);
+	for (size_t threads = 1; threads <= 4; threads += 3)
+	{
+		DiskUsageOptions options;
+		options.threads = threads;
+		DiskUsage usage = pathDiskUsage(root, options);
+
+		std::string prefix = "pathDiskUsage(threads=" + std::to_string(threads) + ") ";
+		checkEqual(prefix + "directory count", usage.directories.size(), caseCount);
+		checkTrue(prefix + "total is the root", usage.total.path == root);
+		checkEqual(prefix + "files without collectFiles", usage.files.size(), 0);
+
+		for (size_t i = 0; i < usage.directories.size() && i < caseCount; i++)
+		{
+			const DiskUsageCase & c = g_diskUsageCases[i];
+			const DiskUsageEntry & entry = usage.directories[i];
+			std::string what = prefix + "\"" + c.path + "\" ";
+
+			uint64_t expectedBytes = c.fileBytes;
+			for (const DiskUsageCase & other : g_diskUsageCases)
+			{
+				if (isSameOrUnder(other.path, c.path))
+					expectedBytes += lstatSize(pathConcat(root, other.path));
+			}
+			if (isSameOrUnder("d", c.path))
+				expectedBytes += linkBytes;
+
+			checkEqual(what + "path", entry.path, *c.path ? pathConcat(root, c.path) : root);
+			checkEqual(what + "files", entry.files, c.files);
+			checkEqual(what + "directories", entry.directories, c.directories);
+			checkEqual(what + "apparent bytes", entry.apparentBytes, expectedBytes);
+		}
+	}
+
+	checkThrows("pathDiskUsage() of a file", [&root]() { pathDiskUsage(pathConcat(root, "a/a2.dat")); });
+	checkThrows("pathDiskUsage() of a missing directory", [&root]() { pathDiskUsage(pathConcat(root, "missing")); });
+}
+
+// Directories on another file system are skipped with oneFileSystem. This needs a tmpfs mounted inside the tree,
+// which is only possible as root on Linux; elsewhere the check is skipped.
+static void checkDiskUsageOneFileSystem(const std::string & root)
+{
+  #ifdef __linux__
+	std::string mountPoint = pathConcat(root, "mnt");
+	pathCreate(mountPoint);
+	writeFileOfSize(pathConcat(root, "outer.dat"), 10);
+	if (mount("path-util-check", mountPoint.c_str(), "tmpfs", 0, nullptr) < 0)
+		return;
+
+	try
+	{
+		writeFileOfSize(pathConcat(mountPoint, "inner.dat"), 10);
+
+		DiskUsage all = pathDiskUsage(root);
+		checkEqual("pathDiskUsage() across a mount point: files", all.total.files, 2);
+		checkEqual("pathDiskUsage() across a mount point: directories", all.total.directories, 1);
+
+		DiskUsageOptions options;
+		options.oneFileSystem = true;
+		DiskUsage one = pathDiskUsage(root, options);
+		checkEqual("pathDiskUsage(oneFileSystem) across a mount point: files", one.total.files, 1);
+		checkEqual("pathDiskUsage(oneFileSystem) across a mount point: directories", one.total.directories, 0);
+		checkEqual("pathDiskUsage(oneFileSystem) across a mount point: entries", one.directories.size(), 1);
+	}
+	catch (...)
+	{
+		umount2(mountPoint.c_str(), MNT_DETACH);
+		throw;
+	}
+	umount2(mountPoint.c_str(), MNT_DETACH);
+  #else
+	(void)root;
+  #endif
+}
+
+// Files of the eviction tree with their access times, in the order they are to be evicted: oldest first, and by
+// path when the access times are equal.
+struct EvictionCase
+{
+	const char * path;
+	time_t accessTime;
+};
+
+static const EvictionCase g_evictionCases[] = {
+	{ "w.dat",     1000000100 },
+	{ "y.dat",     1000000100 },
+	{ "sub/v.dat", 1000000200 },
+	{ "z.dat",     1000000200 },
+	{ "x.dat",     1000000300 },
+};
+
+static void checkEviction(const std::string & root)
+{
+	const size_t caseCount = sizeof(g_evictionCases) / sizeof(g_evictionCases[0]);
+
+	// Written in reverse so that neither creation order nor readdir order matches the expected one.
+	pathCreate(pathConcat(root, "sub"));
+	for (size_t i = caseCount; i-- > 0;)
+	{
+		std::string path = pathConcat(root, g_evictionCases[i].path);
+		writeFileOfSize(path, 5000);
+		setAccessTime(path, g_evictionCases[i].accessTime);
+	}
+
+	DiskUsageOptions options;
+	options.collectFiles = true;
+	DiskUsage usage = pathDiskUsage(root, options);
+	checkEqual("pathDiskUsage(collectFiles) files", usage.files.size(), caseCount);
+
+	DiskUsageFileList all = pathPlanEviction(usage, 0);
+	checkEqual("pathPlanEviction(0) count", all.size(), caseCount);
+	for (size_t i = 0; i < all.size() && i < caseCount; i++)
+	{
+		std::string what = "pathPlanEviction(0)[" + std::to_string(i) + "] ";
+		checkEqual(what + "path", all[i].path, pathConcat(root, g_evictionCases[i].path));
+		checkEqual(what + "access time", static_cast<size_t>(all[i].accessTime),
+			static_cast<size_t>(g_evictionCases[i].accessTime));
+	}
+
+	// Eviction stops as soon as the remaining size fits.
+	if (all.size() >= 2)
+	{
+		uint64_t maxBytes = usage.total.allocatedBytes - all[0].allocatedBytes - all[1].allocatedBytes;
+		DiskUsageFileList two = pathPlanEviction(usage, maxBytes);
+		checkEqual("pathPlanEviction() just below the size of two files", two.size(), 2);
+		checkEqual("pathPlanEviction(total - 1) count", pathPlanEviction(usage, usage.total.allocatedBytes - 1).size(),
+			1);
+	}
+	checkEqual("pathPlanEviction(total) count", pathPlanEviction(usage, usage.total.allocatedBytes).size(), 0);
+
+	DiskUsage uncollected = pathDiskUsage(root);
+	checkThrows("pathPlanEviction() without collected files", [&uncollected]() { pathPlanEviction(uncollected, 0); });
+}
+
+//
+// Instrumentation
+//
+
+static bool isSnapshotEmpty(const PathOperationStatsList & stats)
+{
+	for (const PathOperationStats & op : stats)
+	{
+		if (op.calls != 0 || op.syscalls != 0 || op.bytes != 0 || op.entries != 0 || op.nanoseconds != 0)
+			return false;
+		for (size_t i = 0; i < PathLatencyBucketCount; i++)
+			if (op.latencyHistogram[i] != 0)
+				return false;
+	}
+	return true;
+}
+
+// Checks the histogram of one operation in the Prometheus text format: a cumulative `_bucket` line per bucket,
+// the last one for "+Inf" and equal to the number of calls.
+static void checkFormattedHistogram(const std::string & text, const PathOperationStats & op)
+{
+	std::string what = std::string("pathFormatInstrumentationSnapshot() ") + op.name + " ";
+	std::string prefix = std::string("path_util_latency_seconds_bucket{op=\"") + op.name + "\",le=\"";
+
+	std::stringstream lines(text);
+	std::string line, lastBound;
+	size_t buckets = 0;
+	uint64_t previous = 0, last = 0;
+	bool cumulative = true;
+	while (std::getline(lines, line))
+	{
+		if (line.compare(0, prefix.length(), prefix) != 0)
+			continue;
+		size_t end = line.find("\"} ", prefix.length());
+		if (end == std::string::npos)
+			continue;
+		lastBound = line.substr(prefix.length(), end - prefix.length());
+		last = std::stoull(line.substr(end + 3));
+		if (last < previous)
+			cumulative = false;
+		previous = last;
+		++buckets;
+	}
+
+	checkEqual(what + "bucket lines", buckets, PathLatencyBucketCount);
+	checkTrue(what + "buckets are cumulative", cumulative);
+	checkEqual(what + "last bucket", lastBound, "+Inf");
+	checkEqual(what + "+Inf bucket", static_cast<size_t>(last), static_cast<size_t>(op.calls));
+
+	std::string count = std::string("path_util_latency_seconds_count{op=\"") + op.name + "\"} " +
+		std::to_string(op.calls) + "\n";
+	checkTrue(what + "count line", text.find(count) != std::string::npos);
+}
+
+static void checkInstrumentation(const std::string & root)
+{
+	if (!pathIsInstrumentationEnabled())
+	{
+		checkTrue("snapshot without instrumentation is empty", isSnapshotEmpty(pathGetInstrumentationSnapshot()));
+		return;
+	}
+
+	// A call nested in another operation is counted as part of the outer one only.
+	pathResetInstrumentation();
+	pathCreate(pathConcat(root, "created"));
+	PathOperationStatsList stats = pathGetInstrumentationSnapshot();
+	checkEqual("pathCreate() calls", stats[PathOp_Create].calls, 1);
+	checkTrue("pathCreate() syscalls", stats[PathOp_Create].syscalls > 0);
+	checkEqual("pathMakeAbsolute() calls inside pathCreate()", stats[PathOp_MakeAbsolute].calls, 0);
+	checkEqual("pathGetCurrentDirectory() calls inside pathCreate()", stats[PathOp_GetCurrentDirectory].calls, 0);
+	checkEqual("pathConcat() calls", stats[PathOp_Concat].calls, 1);
+
+	// Resetting zeroes the snapshots that follow, and counting goes on from there.
+	pathResetInstrumentation();
+	checkTrue("snapshot after pathResetInstrumentation() is empty", isSnapshotEmpty(pathGetInstrumentationSnapshot()));
+	pathSimplify("a/./b");
+	checkEqual("pathSimplify() calls after a reset", pathGetInstrumentationSnapshot()[PathOp_Simplify].calls, 1);
+
+	// Counts of threads that have exited are kept.
+	std::thread thread([]() {
+		for (int i = 0; i < 10; i++)
+			pathSimplify("a/../b");
+	});
+	thread.join();
+	stats = pathGetInstrumentationSnapshot();
+	checkEqual("pathSimplify() calls including an exited thread", stats[PathOp_Simplify].calls, 11);
+
+	std::string text = pathFormatInstrumentationSnapshot(stats);
+	checkFormattedHistogram(text, stats[PathOp_Simplify]);
+	checkFormattedHistogram(text, stats[PathOp_Create]);
+}
+
+static void checkFileSystemFunctions()
+{
+	std::string root = makeTempDirectory();
+	try
+	{
+		std::string writeDir = pathConcat(root, "write");
+		pathCreate(writeDir);
+		checkAtomicWrites(writeDir);
+
+		std::string usageDir = pathConcat(root, "usage");
+		pathCreate(usageDir);
+		checkDiskUsage(usageDir);
+
+		std::string mountDir = pathConcat(root, "mount");
+		pathCreate(mountDir);
+		checkDiskUsageOneFileSystem(mountDir);
+
+		std::string evictDir = pathConcat(root, "evict");
+		pathCreate(evictDir);
+		checkEviction(evictDir);
+
+		checkInstrumentation(root);
+	}
+	catch (...)
+	{
+		deleteTree(root);
+		throw;
+	}
+	deleteTree(root);
+}
+
+#endif
+
+//
+// pmr overloads
+//
+
+#ifdef PATH_UTIL_HAS_PMR
+
+static std::string makeRandomPath(uint32_t & seed)
+{
+	static const char * const components[] = { "a", "bb", ".", "..", "c.d", "", ".e", "~", "f.tar.gz" };
+	const size_t componentCount = sizeof(components) / sizeof(components[0]);
+
+	std::string path;
+	seed = seed * 1664525u + 1013904223u;
+	size_t length = (seed >> 16) % 7;
+	for (size_t i = 0; i < length; i++)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		if (i > 0 || (seed >> 8) % 3 == 0)
+			path += pathSeparator();
+		path += components[(seed >> 16) % componentCount];
+	}
+	return path;
+}
+
+// Checks that the pmr overload gives the same result as the std::string one and takes no memory from the global
+// allocator.
+template <class Function, class PmrFunction>
+static void checkPmr(const std::string & what, Function function, PmrFunction pmrFunction)
+{
+	std::string expected = function();
+
+	char buffer[4096];
+	std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+	uint64_t allocations = g_allocationCount.load();
+	std::pmr::string actual = pmrFunction(&arena);
+	allocations = g_allocationCount.load() - allocations;
+
+	checkEqual(what + " (pmr)", std::string(actual.data(), actual.length()), expected);
+	checkEqual(what + " (pmr global allocations)", static_cast<size_t>(allocations), 0);
+}
+
+static void checkPmrOverloads()
+{
+	const std::string base = pathToNativeSeparators("/base/dir");
+
+	uint32_t seed = 12345;
+	for (size_t i = 0; i < 2000; i++)
+	{
+		std::string path = makeRandomPath(seed);
+		std::string other = makeRandomPath(seed);
+		std::string desc = "\"" + path + "\"";
+
+		checkPmr("pathSimplify(" + desc + ")",
+			[&]() { return pathSimplify(path); },
+			[&](std::pmr::memory_resource * r) { return pathSimplify(path, r); });
+		checkPmr("pathConcat(" + desc + ")",
+			[&]() { return pathConcat(path, other); },
+			[&](std::pmr::memory_resource * r) { return pathConcat(path, other, r); });
+		checkPmr("pathMakeAbsolute(" + desc + ")",
+			[&]() { return pathMakeAbsolute(path, base); },
+			[&](std::pmr::memory_resource * r) { return pathMakeAbsolute(path, base, r); });
+		checkPmr("pathGetDirectory(" + desc + ")",
+			[&]() { return pathGetDirectory(path); },
+			[&](std::pmr::memory_resource * r) { return pathGetDirectory(path, r); });
+		checkPmr("pathGetFileName(" + desc + ")",
+			[&]() { return pathGetFileName(path); },
+			[&](std::pmr::memory_resource * r) { return pathGetFileName(path, r); });
+		checkPmr("pathGetShortFileExtension(" + desc + ")",
+			[&]() { return pathGetShortFileExtension(path); },
+			[&](std::pmr::memory_resource * r) { return pathGetShortFileExtension(path, r); });
+		checkPmr("pathGetFullFileExtension(" + desc + ")",
+			[&]() { return pathGetFullFileExtension(path); },
+			[&](std::pmr::memory_resource * r) { return pathGetFullFileExtension(path, r); });
+		checkPmr("pathReplaceFullFileExtension(" + desc + ")",
+			[&]() { return pathReplaceFullFileExtension(path, ".o"); },
+			[&](std::pmr::memory_resource * r) { return pathReplaceFullFileExtension(path, ".o", r); });
+	}
+
+  #ifndef _WIN32
+	checkPmr("pathGetUserHomeDirectory()",
+		[]() { return pathGetUserHomeDirectory(); },
+		[](std::pmr::memory_resource * r) { return pathGetUserHomeDirectory(r); });
+	checkPmr("pathGetCurrentDirectory()",
+		[]() { return pathGetCurrentDirectory(); },
+		[](std::pmr::memory_resource * r) { return pathGetCurrentDirectory(r); });
+	checkPmr("pathMakeAbsolute(\"a/b\")",
+		[]() { return pathMakeAbsolute("a/b"); },
+		[](std::pmr::memory_resource * r) { return pathMakeAbsolute("a/b", r); });
+  #endif
+}
+
+#endif
+
+//
+// Async operations
+//
+
+#ifdef PATH_UTIL_HAS_COROUTINES
+
+// Coroutine that starts right away and frees itself when it finishes.
+struct CheckTask
+{
+	struct promise_type
+	{
+		CheckTask get_return_object() { return CheckTask(); }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+struct AsyncOutcome
+{
+	std::atomic<int> resumes;
+	std::atomic<int> executions;
+	std::atomic<bool> cancelled;
+	std::thread::id thread;
+	int value;
+
+	AsyncOutcome() : resumes(0), executions(0), cancelled(false), value(0) {}
+};
+
+static CheckTask runAsyncOperation(std::function<int()> function, std::stop_token token, AsyncOutcome * outcome)
+{
+	try
+	{
+		outcome->value = co_await pathRunAsync<int>([function, outcome]() {
+			outcome->executions.fetch_add(1);
+			return function();
+		}, token);
+	}
+	catch (const PathOperationCancelled &)
+	{
+		outcome->cancelled.store(true);
+	}
+	outcome->thread = std::this_thread::get_id();
+	outcome->resumes.fetch_add(1);
+}
+
+template <class Predicate> static bool waitUntil(Predicate predicate)
+{
+	for (int i = 0; i < 10000; i++)
+	{
+		if (predicate())
+			return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return predicate();
+}
+
+// Function for an operation that keeps its worker busy until the gate is opened.
+static std::function<int()> makeBlockingFunction(std::atomic<bool> * gate, std::atomic<int> * started)
+{
+	return [gate, started]() {
+		started->fetch_add(1);
+		while (!gate->load())
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		return 0;
+	};
+}
+
+// Resume handler that defers resumption to the thread calling resumeAll(), like an event loop would.
+struct ResumeQueue
+{
+	std::mutex mutex;
+	std::deque<std::coroutine_handle<>> handles;
+	std::atomic<int> posted;
+
+	ResumeQueue() : posted(0) {}
+
+	void post(std::coroutine_handle<> handle)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		handles.push_back(handle);
+		posted.fetch_add(1);
+	}
+
+	void resumeAll()
+	{
+		for (;;)
+		{
+			std::coroutine_handle<> handle;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (handles.empty())
+					return;
+				handle = handles.front();
+				handles.pop_front();
+			}
+			handle.resume();
+		}
+	}
+};
+
+static void checkAsyncOperations()
+{
+	size_t concurrency = pathGetAsyncConcurrency();
+	std::function<int()> answer = []() { return 42; };
+
+	// A stop requested before submission completes the operation right away, without reaching the pool.
+	{
+		std::stop_source source;
+		source.request_stop();
+		AsyncOutcome outcome;
+		runAsyncOperation(answer, source.get_token(), &outcome);
+		checkEqual("stopped before submission: resumed synchronously", outcome.resumes.load(), 1);
+		checkTrue("stopped before submission: cancelled", outcome.cancelled.load());
+		checkEqual("stopped before submission: executed", outcome.executions.load(), 0);
+		checkTrue("stopped before submission: resumed on this thread", outcome.thread == std::this_thread::get_id());
+	}
+
+	// A stop requested while queued resumes the coroutine exactly once, from request_stop(), and the worker
+	// skips the job when it gets to it.
+	{
+		pathSetAsyncConcurrency(1);
+		std::atomic<bool> gate(false);
+		std::atomic<int> started(0);
+		AsyncOutcome blocker, queued, after;
+		runAsyncOperation(makeBlockingFunction(&gate, &started), std::stop_token(), &blocker);
+		checkTrue("stopped while queued: blocker started", waitUntil([&started]() { return started.load() == 1; }));
+
+		std::stop_source source;
+		runAsyncOperation(answer, source.get_token(), &queued);
+		checkEqual("stopped while queued: resumed before the stop", queued.resumes.load(), 0);
+		source.request_stop();
+		checkEqual("stopped while queued: resumed by request_stop()", queued.resumes.load(), 1);
+		checkTrue("stopped while queued: resumed on the stopping thread",
+			queued.thread == std::this_thread::get_id());
+
+		runAsyncOperation(answer, std::stop_token(), &after);
+		gate.store(true);
+		checkTrue("stopped while queued: later job completed",
+			waitUntil([&after]() { return after.resumes.load() == 1; }));
+		checkTrue("stopped while queued: blocker completed",
+			waitUntil([&blocker]() { return blocker.resumes.load() == 1; }));
+		checkEqual("stopped while queued: resumes", queued.resumes.load(), 1);
+		checkEqual("stopped while queued: executed", queued.executions.load(), 0);
+		checkTrue("stopped while queued: cancelled", queued.cancelled.load());
+		checkEqual("stopped while queued: result of the later job", after.value, 42);
+	}
+
+	// Lowering the concurrency parks workers without losing the jobs that are queued.
+	{
+		const int blockerCount = 4;
+		const int jobCount = 16;
+		pathSetAsyncConcurrency(blockerCount);
+		std::atomic<bool> gate(false);
+		std::atomic<int> started(0);
+		std::vector<AsyncOutcome> blockers(blockerCount), jobs(jobCount);
+		for (AsyncOutcome & outcome : blockers)
+			runAsyncOperation(makeBlockingFunction(&gate, &started), std::stop_token(), &outcome);
+		checkTrue("lowered concurrency: blockers started",
+			waitUntil([&started, blockerCount]() { return started.load() == blockerCount; }));
+
+		pathSetAsyncConcurrency(1);
+		std::atomic<int> running(0), maxRunning(0);
+		std::function<int()> counted = [&running, &maxRunning]() {
+			int now = running.fetch_add(1) + 1;
+			int max = maxRunning.load();
+			while (now > max && !maxRunning.compare_exchange_weak(max, now))
+				;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			running.fetch_sub(1);
+			return 1;
+		};
+		for (AsyncOutcome & outcome : jobs)
+			runAsyncOperation(counted, std::stop_token(), &outcome);
+		gate.store(true);
+
+		checkTrue("lowered concurrency: all jobs completed", waitUntil([&jobs, &blockers]() {
+			for (const AsyncOutcome & outcome : jobs)
+				if (outcome.resumes.load() != 1)
+					return false;
+			for (const AsyncOutcome & outcome : blockers)
+				if (outcome.resumes.load() != 1)
+					return false;
+			return true;
+		}));
+		checkEqual("lowered concurrency: jobs running at once", static_cast<size_t>(maxRunning.load()), 1);
+	}
+
+	// The resume handler is used both for completed and for cancelled operations.
+	{
+		pathSetAsyncConcurrency(1);
+		ResumeQueue resumeQueue;
+		pathSetAsyncResumeHandler([&resumeQueue](std::coroutine_handle<> handle) { resumeQueue.post(handle); });
+
+		AsyncOutcome completed;
+		runAsyncOperation(answer, std::stop_token(), &completed);
+		checkTrue("resume handler: completion posted",
+			waitUntil([&resumeQueue]() { return resumeQueue.posted.load() == 1; }));
+		checkEqual("resume handler: resumed before the handler ran", completed.resumes.load(), 0);
+		resumeQueue.resumeAll();
+		checkEqual("resume handler: completion resumed", completed.resumes.load(), 1);
+		checkEqual("resume handler: result", completed.value, 42);
+		checkTrue("resume handler: resumed on this thread", completed.thread == std::this_thread::get_id());
+
+		std::atomic<bool> gate(false);
+		std::atomic<int> started(0);
+		AsyncOutcome blocker, cancelled;
+		runAsyncOperation(makeBlockingFunction(&gate, &started), std::stop_token(), &blocker);
+		checkTrue("resume handler: blocker started", waitUntil([&started]() { return started.load() == 1; }));
+		std::stop_source source;
+		runAsyncOperation(answer, source.get_token(), &cancelled);
+		source.request_stop();
+		checkEqual("resume handler: cancellation posted", resumeQueue.posted.load(), 2);
+		checkEqual("resume handler: resumed before the handler ran", cancelled.resumes.load(), 0);
+		resumeQueue.resumeAll();
+		checkEqual("resume handler: cancellation resumed", cancelled.resumes.load(), 1);
+		checkTrue("resume handler: cancelled", cancelled.cancelled.load());
+
+		gate.store(true);
+		checkTrue("resume handler: blocker posted",
+			waitUntil([&resumeQueue]() { return resumeQueue.posted.load() == 3; }));
+		resumeQueue.resumeAll();
+		checkEqual("resume handler: blocker resumed", blocker.resumes.load(), 1);
+		pathSetAsyncResumeHandler(nullptr);
+	}
+
+	pathSetAsyncConcurrency(concurrency);
+}
+
+#endif
+
+//
+// Entry point
+//
+
+int main()
+{
+  #ifndef _WIN32
+	setenv("HOME", "/home/path-util-check-user", 1);
+  #endif
+
+	try
+	{
+	  #ifndef _WIN32
+		checkStringFunctions();
+		checkRelativePaths();
+		checkFileSystemFunctions();
+	  #endif
+	  #ifdef PATH_UTIL_HAS_PMR
+		checkPmrOverloads();
+	  #endif
+	  #ifdef PATH_UTIL_HAS_COROUTINES
+		checkAsyncOperations();
+	  #endif
+	}
+	catch (const std::exception & e)
+	{
+		fprintf(stderr, "error: %s\n", e.what());
+		return 1;
+	}
+
+	printf("%zu checks, %zu failures\n", g_checks, g_failures);
+	return (g_failures == 0 ? 0 : 1);
+}
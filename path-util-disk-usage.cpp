@@ -0,0 +1,515 @@
+/* vim: set ai noet ts=4 sw=4 tw=115: */
+//
+// Copyright (c) 2014 Nikolay Zapolnov (zapolnov@gmail.com).
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "path-util.h"
+#include "path-util-instrumentation.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+#include <cerrno>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef INCLUDE_DIRENT_H
+#include INCLUDE_DIRENT_H
+#else
+#include <yip-imports/dirent.h>
+#endif
+
+#ifndef _WIN32
+ #include <fcntl.h>
+ #include <unistd.h>
+#endif
+
+static uint64_t pathDiskUsageAllocatedBytes(const struct stat & st)
+{
+  #ifndef _WIN32
+	return static_cast<uint64_t>(st.st_blocks) * 512;
+  #else
+	return static_cast<uint64_t>(st.st_size);
+  #endif
+}
+
+// MSVC's <sys/stat.h> has S_IFMT and S_IFDIR, but not the S_ISDIR() macro.
+static bool pathDiskUsageIsDirectory(const struct stat & st)
+{
+	return (st.st_mode & S_IFMT) == S_IFDIR;
+}
+
+struct DiskUsageNode
+{
+	std::string path;
+	std::string name;
+	DiskUsageNode * parent;
+	int fd;
+	std::atomic<size_t> unopenedChildren;
+	std::atomic<size_t> pending;
+	std::atomic<uint64_t> apparentBytes;
+	std::atomic<uint64_t> allocatedBytes;
+	std::atomic<uint64_t> files;
+	std::atomic<uint64_t> directories;
+
+	DiskUsageNode(const std::string & p, const std::string & n, DiskUsageNode * parentNode, const struct stat & st)
+		: path(p),
+		  name(n),
+		  parent(parentNode),
+		  fd(-1),
+		  unopenedChildren(0),
+		  pending(1),
+		  apparentBytes(static_cast<uint64_t>(st.st_size)),
+		  allocatedBytes(pathDiskUsageAllocatedBytes(st)),
+		  files(0),
+		  directories(0)
+	{
+	}
+};
+
+struct DiskUsageInode
+{
+	uint64_t device;
+	uint64_t inode;
+
+	bool operator==(const DiskUsageInode & other) const { return device == other.device && inode == other.inode; }
+};
+
+struct DiskUsageInodeHash
+{
+	size_t operator()(const DiskUsageInode & key) const
+	{
+		return static_cast<size_t>(key.inode * 0x9e3779b97f4a7c15ULL ^ key.device);
+	}
+};
+
+struct DiskUsageInodeShard
+{
+	std::mutex mutex;
+	std::unordered_set<DiskUsageInode, DiskUsageInodeHash> inodes;
+};
+
+static const size_t DiskUsageInodeShardCount = 64;
+
+struct DiskUsageWorker
+{
+	DiskUsageFileList files;
+	uint64_t syscalls;
+
+	DiskUsageWorker() : syscalls(0) {}
+};
+
+struct DiskUsageWalk
+{
+	DiskUsageOptions options;
+	uint64_t rootDevice;
+
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::vector<DiskUsageNode *> queue;
+	std::deque<DiskUsageNode> nodes;
+	bool finished;
+	std::exception_ptr error;
+
+	DiskUsageInodeShard shards[DiskUsageInodeShardCount];
+
+	DiskUsageWalk() : rootDevice(0), finished(false) {}
+
+	// Descriptors are only left behind when the walk has been aborted.
+	~DiskUsageWalk()
+	{
+	  #ifndef _WIN32
+		for (DiskUsageNode & node : nodes)
+		{
+			if (node.fd >= 0)
+				close(node.fd);
+		}
+	  #endif
+	}
+
+	// Files with several hard links are only accounted for the first time one of their links is seen.
+	bool claimInode(uint64_t device, uint64_t inode)
+	{
+		DiskUsageInode key = { device, inode };
+		DiskUsageInodeShard & shard = shards[DiskUsageInodeHash()(key) % DiskUsageInodeShardCount];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		return shard.inodes.insert(key).second;
+	}
+};
+
+struct DiskUsageSubdirectory
+{
+	std::string name;
+	struct stat st;
+};
+
+static std::string pathDiskUsageJoin(const std::string & dir, const char * name)
+{
+	size_t nameLength = strlen(name);
+	std::string result;
+	result.reserve(dir.length() + nameLength + 1);
+	result += dir;
+	if (result.length() > 0 && !pathIsSeparator(result[result.length() - 1]))
+		result += pathSeparator();
+	result.append(name, nameLength);
+	return result;
+}
+
+static void pathDiskUsageComplete(DiskUsageWalk & walk, DiskUsageNode * node)
+{
+	while (node->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		DiskUsageNode * parent = node->parent;
+		if (!parent)
+		{
+			std::lock_guard<std::mutex> lock(walk.mutex);
+			walk.finished = true;
+			walk.condition.notify_all();
+			return;
+		}
+
+		parent->apparentBytes.fetch_add(node->apparentBytes.load(std::memory_order_relaxed));
+		parent->allocatedBytes.fetch_add(node->allocatedBytes.load(std::memory_order_relaxed));
+		parent->files.fetch_add(node->files.load(std::memory_order_relaxed));
+		parent->directories.fetch_add(node->directories.load(std::memory_order_relaxed) + 1);
+
+		node = parent;
+	}
+}
+
+#ifndef _WIN32
+static void pathDiskUsageReleaseParent(DiskUsageWorker & worker, DiskUsageNode * parent)
+{
+	if (parent->unopenedChildren.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		++worker.syscalls;
+		close(parent->fd);
+		parent->fd = -1;
+	}
+}
+#endif
+
+static void pathDiskUsageProcess(DiskUsageWalk & walk, DiskUsageWorker & worker, DiskUsageNode * node)
+{
+	uint64_t apparentBytes = 0;
+	uint64_t allocatedBytes = 0;
+	uint64_t files = 0;
+	std::vector<DiskUsageSubdirectory> subdirs;
+
+	// Subdirectories are opened and entries are stat'ed relative to the parent directory descriptor, which spares
+	// the kernel a full path lookup for every one of them. A parent keeps its descriptor open until all of its
+	// subdirectories have been opened. The root itself may be a symlink to a directory; nothing below it is followed.
+  #ifndef _WIN32
+	++worker.syscalls;
+	int fd;
+	if (!node->parent)
+		fd = open(node->path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	else
+	{
+		fd = openat(node->parent->fd, node->name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		int openErr = errno;
+		pathDiskUsageReleaseParent(worker, node->parent);
+		errno = openErr;
+	}
+	DIR * dir = (fd >= 0 ? fdopendir(fd) : nullptr);
+	int err = errno;
+	if (!dir && fd >= 0)
+		close(fd);
+  #else
+	++worker.syscalls;
+	DIR * dir = opendir(node->path.c_str());
+	int err = errno;
+  #endif
+
+	if (!dir)
+	{
+		if (err != ENOENT)
+		{
+			std::stringstream ss;
+			ss << "unable to enumerate contents of directory '" << node->path << "': " << strerror(err);
+			throw std::runtime_error(ss.str());
+		}
+	}
+	else
+	{
+		try
+		{
+			struct dirent * ent;
+			while ((ent = readdir(dir)) != nullptr)
+			{
+				const char * name = ent->d_name;
+				if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+					continue;
+
+				struct stat st;
+				++worker.syscalls;
+			  #ifndef _WIN32
+				int r = fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW);
+			  #else
+				int r = stat(pathDiskUsageJoin(node->path, name).c_str(), &st);
+			  #endif
+				if (r < 0)
+				{
+					err = errno;
+					if (err == ENOENT)
+						continue;
+					std::stringstream ss;
+					ss << "unable to stat file '" << pathDiskUsageJoin(node->path, name) << "': " << strerror(err);
+					throw std::runtime_error(ss.str());
+				}
+
+				if (pathDiskUsageIsDirectory(st))
+				{
+					if (walk.options.oneFileSystem && static_cast<uint64_t>(st.st_dev) != walk.rootDevice)
+						continue;
+					DiskUsageSubdirectory subdir = { name, st };
+					subdirs.push_back(subdir);
+					continue;
+				}
+
+				if (st.st_nlink > 1 && !walk.claimInode(st.st_dev, st.st_ino))
+					continue;
+
+				uint64_t allocated = pathDiskUsageAllocatedBytes(st);
+				apparentBytes += static_cast<uint64_t>(st.st_size);
+				allocatedBytes += allocated;
+				++files;
+
+				if (walk.options.collectFiles)
+				{
+					DiskUsageFile file;
+					file.path = pathDiskUsageJoin(node->path, name);
+					file.allocatedBytes = allocated;
+					file.accessTime = st.st_atime;
+					worker.files.push_back(file);
+				}
+			}
+
+		  #ifndef _WIN32
+			if (!subdirs.empty())
+			{
+				++worker.syscalls;
+				node->fd = fcntl(dirfd(dir), F_DUPFD_CLOEXEC, 0);
+				if (node->fd < 0)
+				{
+					err = errno;
+					std::stringstream ss;
+					ss << "unable to enumerate contents of directory '" << node->path << "': " << strerror(err);
+					throw std::runtime_error(ss.str());
+				}
+				node->unopenedChildren.store(subdirs.size());
+			}
+		  #endif
+		}
+		catch (...)
+		{
+			closedir(dir);
+			throw;
+		}
+
+		closedir(dir);
+	}
+
+	node->apparentBytes.fetch_add(apparentBytes);
+	node->allocatedBytes.fetch_add(allocatedBytes);
+	node->files.fetch_add(files);
+
+	if (!subdirs.empty())
+	{
+		node->pending.fetch_add(subdirs.size());
+		{
+			std::lock_guard<std::mutex> lock(walk.mutex);
+			for (const DiskUsageSubdirectory & subdir : subdirs)
+			{
+				walk.nodes.emplace_back(pathDiskUsageJoin(node->path, subdir.name.c_str()), subdir.name, node,
+					subdir.st);
+				walk.queue.push_back(&walk.nodes.back());
+			}
+		}
+		if (subdirs.size() > 1)
+			walk.condition.notify_all();
+		else
+			walk.condition.notify_one();
+	}
+
+	pathDiskUsageComplete(walk, node);
+}
+
+static void pathDiskUsageWorker(DiskUsageWalk * walk, DiskUsageWorker * worker)
+{
+	for (;;)
+	{
+		DiskUsageNode * node;
+		{
+			std::unique_lock<std::mutex> lock(walk->mutex);
+			while (walk->queue.empty() && !walk->finished)
+				walk->condition.wait(lock);
+			if (walk->finished)
+				return;
+
+			// Depth-first order keeps the queue short and directories that are close to each other together.
+			node = walk->queue.back();
+			walk->queue.pop_back();
+		}
+
+		try
+		{
+			pathDiskUsageProcess(*walk, *worker, node);
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(walk->mutex);
+			if (!walk->error)
+				walk->error = std::current_exception();
+			walk->finished = true;
+			walk->condition.notify_all();
+			return;
+		}
+	}
+}
+
+static DiskUsageEntry pathDiskUsageMakeEntry(const DiskUsageNode & node)
+{
+	DiskUsageEntry entry;
+	entry.path = node.path;
+	entry.apparentBytes = node.apparentBytes.load();
+	entry.allocatedBytes = node.allocatedBytes.load();
+	entry.files = node.files.load();
+	entry.directories = node.directories.load();
+	return entry;
+}
+
+DiskUsage pathDiskUsage(const std::string & path, const DiskUsageOptions & options)
+{
+	PATH_UTIL_OPERATION(PathOp_DiskUsage);
+	PATH_UTIL_COUNT_SYSCALLS(1);
+
+	struct stat st;
+	int err = (stat(path.c_str(), &st) < 0 ? errno : (pathDiskUsageIsDirectory(st) ? 0 : ENOTDIR));
+	if (err != 0)
+	{
+		std::stringstream ss;
+		ss << "unable to compute disk usage for '" << path << "': " << strerror(err);
+		throw std::runtime_error(ss.str());
+	}
+
+	DiskUsageWalk walk;
+	walk.options = options;
+	walk.rootDevice = static_cast<uint64_t>(st.st_dev);
+	walk.nodes.emplace_back(path, std::string(), nullptr, st);
+	walk.queue.push_back(&walk.nodes.back());
+
+	size_t threadCount = options.threads;
+	if (threadCount == 0)
+		threadCount = std::max(static_cast<size_t>(std::thread::hardware_concurrency()), static_cast<size_t>(4));
+
+	std::vector<DiskUsageWorker> workers(threadCount);
+	std::vector<std::thread> threads;
+	threads.reserve(threadCount - 1);
+	try
+	{
+		for (size_t i = 1; i < threadCount; i++)
+			threads.emplace_back(pathDiskUsageWorker, &walk, &workers[i]);
+	}
+	catch (...)
+	{
+		{
+			std::lock_guard<std::mutex> lock(walk.mutex);
+			walk.finished = true;
+		}
+		walk.condition.notify_all();
+		for (std::thread & thread : threads)
+			thread.join();
+		throw;
+	}
+
+	pathDiskUsageWorker(&walk, &workers[0]);
+	for (std::thread & thread : threads)
+		thread.join();
+
+	if (walk.error)
+		std::rethrow_exception(walk.error);
+
+	DiskUsage usage;
+	usage.total = pathDiskUsageMakeEntry(walk.nodes.front());
+
+	usage.directories.reserve(walk.nodes.size());
+	for (const DiskUsageNode & node : walk.nodes)
+		usage.directories.push_back(pathDiskUsageMakeEntry(node));
+	std::sort(usage.directories.begin(), usage.directories.end(),
+		[](const DiskUsageEntry & a, const DiskUsageEntry & b) { return a.path < b.path; });
+
+	size_t fileCount = 0;
+	for (const DiskUsageWorker & worker : workers)
+		fileCount += worker.files.size();
+	usage.files.reserve(fileCount);
+	for (DiskUsageWorker & worker : workers)
+	{
+		PATH_UTIL_COUNT_SYSCALLS(worker.syscalls);
+		for (DiskUsageFile & file : worker.files)
+			usage.files.push_back(std::move(file));
+	}
+
+	PATH_UTIL_COUNT_ENTRIES(usage.total.files + usage.total.directories + 1);
+
+	return usage;
+}
+
+DiskUsageFileList pathPlanEviction(const DiskUsage & usage, uint64_t maxBytes)
+{
+	PATH_UTIL_OPERATION(PathOp_PlanEviction);
+	PATH_UTIL_COUNT_ENTRIES(usage.files.size());
+
+	DiskUsageFileList result;
+	if (usage.total.allocatedBytes <= maxBytes)
+		return result;
+
+	if (usage.files.empty() && usage.total.files > 0)
+		throw std::runtime_error("unable to plan eviction: disk usage was computed without collecting files.");
+
+	std::vector<const DiskUsageFile *> files;
+	files.reserve(usage.files.size());
+	for (const DiskUsageFile & file : usage.files)
+		files.push_back(&file);
+
+	std::sort(files.begin(), files.end(), [](const DiskUsageFile * a, const DiskUsageFile * b) {
+		if (a->accessTime != b->accessTime)
+			return a->accessTime < b->accessTime;
+		return a->path < b->path;
+	});
+
+	uint64_t remaining = usage.total.allocatedBytes;
+	for (const DiskUsageFile * file : files)
+	{
+		if (remaining <= maxBytes)
+			break;
+		result.push_back(*file);
+		remaining -= std::min(remaining, file->allocatedBytes);
+	}
+
+	return result;
+}
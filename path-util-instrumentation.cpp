@@ -0,0 +1,297 @@
+/* vim: set ai noet ts=4 sw=4 tw=115: */
+//
+// Copyright (c) 2014 Nikolay Zapolnov (zapolnov@gmail.com).
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "path-util-instrumentation.h"
+#include <sstream>
+#include <cstring>
+
+#ifdef PATH_UTIL_INSTRUMENTATION
+ #include <algorithm>
+ #include <atomic>
+ #include <mutex>
+#endif
+
+static const char * const g_operationNames[PathOp_Count] = {
+	"pathToNativeSeparators",
+	"pathToUnixSeparators",
+	"pathGetCurrentDirectory",
+	"pathGetUserHomeDirectory",
+	"pathIsAbsolute",
+	"pathMakeAbsolute",
+	"pathSimplify",
+	"pathMakeCanonical",
+	"pathConcat",
+	"pathGetDirectory",
+	"pathGetFileName",
+	"pathGetShortFileExtension",
+	"pathGetFullFileExtension",
+	"pathReplaceFullFileExtension",
+	"pathCreate",
+	"pathIsExistent",
+	"pathIsFile",
+	"pathGetModificationTime",
+	"pathGetThisExecutableFile",
+	"pathCreateSymLink",
+	"pathEnumDirectoryContents",
+	"pathDeleteFile",
+	"pathWriteFileAtomic",
+	"pathWriteFilesAtomic",
+	"pathMakeRelative",
+	"pathIsUnder",
+	"pathCommonPrefix",
+	"pathFindContainingRoots",
+	"pathDiskUsage",
+	"pathPlanEviction",
+};
+
+#ifdef PATH_UTIL_INSTRUMENTATION
+
+enum
+{
+	Counter_Calls = 0,
+	Counter_Syscalls,
+	Counter_Bytes,
+	Counter_Entries,
+	Counter_Nanoseconds,
+	Counter_Histogram,
+	CountersPerOperation = Counter_Histogram + PathLatencyBucketCount
+};
+
+// Every thread only ever writes its own counters, so updates are plain relaxed loads and stores without any
+// read-modify-write; readers may observe slightly stale values, which is fine for metrics.
+struct PathThreadCounters
+{
+	std::atomic<uint64_t> values[PathOp_Count][CountersPerOperation];
+};
+
+struct PathInstrumentationRegistry
+{
+	std::mutex mutex;
+	std::vector<PathThreadCounters *> threads;
+	uint64_t retired[PathOp_Count][CountersPerOperation];
+	uint64_t baseline[PathOp_Count][CountersPerOperation];
+};
+
+static PathInstrumentationRegistry & pathInstrumentationRegistry()
+{
+	// Intentionally leaked: threads may exit (and unregister) after static destructors have run.
+	static PathInstrumentationRegistry * registry = new PathInstrumentationRegistry();
+	return *registry;
+}
+
+class PathThreadCountersHolder
+{
+public:
+	PathThreadCounters * counters;
+
+	PathThreadCountersHolder()
+		: counters(new PathThreadCounters())
+	{
+		PathInstrumentationRegistry & registry = pathInstrumentationRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		registry.threads.push_back(counters);
+	}
+
+	~PathThreadCountersHolder()
+	{
+		PathInstrumentationRegistry & registry = pathInstrumentationRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		for (size_t op = 0; op < PathOp_Count; op++)
+		{
+			for (size_t i = 0; i < CountersPerOperation; i++)
+				registry.retired[op][i] += counters->values[op][i].load(std::memory_order_relaxed);
+		}
+		registry.threads.erase(std::remove(registry.threads.begin(), registry.threads.end(), counters),
+			registry.threads.end());
+		delete counters;
+	}
+};
+
+static thread_local PathThreadCountersHolder t_counters;
+thread_local PathOperationScope * g_pathCurrentOperation;
+
+static inline void pathIncrementCounter(std::atomic<uint64_t> & counter, uint64_t value)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+static inline size_t pathLatencyBucket(uint64_t ns)
+{
+	if (ns < 2)
+		return 0;
+  #if defined(__GNUC__) || defined(__clang__)
+	size_t bucket = 63 - static_cast<size_t>(__builtin_clzll(ns));
+  #else
+	size_t bucket = 0;
+	while (ns >>= 1)
+		++bucket;
+  #endif
+	return std::min(bucket, PathLatencyBucketCount - 1);
+}
+
+PathOperationScope::PathOperationScope(PathOperation op)
+	: m_operation(op),
+	  m_outermost(!g_pathCurrentOperation),
+	  m_syscalls(0),
+	  m_bytes(0),
+	  m_entries(0)
+{
+	if (m_outermost)
+	{
+		g_pathCurrentOperation = this;
+		m_start = std::chrono::steady_clock::now();
+	}
+}
+
+PathOperationScope::~PathOperationScope()
+{
+	if (!m_outermost)
+		return;
+
+	uint64_t ns = static_cast<uint64_t>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count());
+
+	g_pathCurrentOperation = nullptr;
+
+	std::atomic<uint64_t> * values = t_counters.counters->values[m_operation];
+	pathIncrementCounter(values[Counter_Calls], 1);
+	pathIncrementCounter(values[Counter_Syscalls], m_syscalls);
+	pathIncrementCounter(values[Counter_Bytes], m_bytes);
+	pathIncrementCounter(values[Counter_Entries], m_entries);
+	pathIncrementCounter(values[Counter_Nanoseconds], ns);
+	pathIncrementCounter(values[Counter_Histogram + pathLatencyBucket(ns)], 1);
+}
+
+#endif
+
+bool pathIsInstrumentationEnabled()
+{
+  #ifdef PATH_UTIL_INSTRUMENTATION
+	return true;
+  #else
+	return false;
+  #endif
+}
+
+PathOperationStatsList pathGetInstrumentationSnapshot()
+{
+	PathOperationStatsList list(PathOp_Count);
+
+  #ifdef PATH_UTIL_INSTRUMENTATION
+	uint64_t totals[PathOp_Count][CountersPerOperation];
+
+	PathInstrumentationRegistry & registry = pathInstrumentationRegistry();
+	{
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		for (size_t op = 0; op < PathOp_Count; op++)
+		{
+			for (size_t i = 0; i < CountersPerOperation; i++)
+			{
+				uint64_t value = registry.retired[op][i];
+				for (PathThreadCounters * counters : registry.threads)
+					value += counters->values[op][i].load(std::memory_order_relaxed);
+				totals[op][i] = value - registry.baseline[op][i];
+			}
+		}
+	}
+  #endif
+
+	for (size_t op = 0; op < PathOp_Count; op++)
+	{
+		PathOperationStats & stats = list[op];
+		memset(&stats, 0, sizeof(stats));
+		stats.name = g_operationNames[op];
+
+	  #ifdef PATH_UTIL_INSTRUMENTATION
+		stats.calls = totals[op][Counter_Calls];
+		stats.syscalls = totals[op][Counter_Syscalls];
+		stats.bytes = totals[op][Counter_Bytes];
+		stats.entries = totals[op][Counter_Entries];
+		stats.nanoseconds = totals[op][Counter_Nanoseconds];
+		for (size_t i = 0; i < PathLatencyBucketCount; i++)
+			stats.latencyHistogram[i] = totals[op][Counter_Histogram + i];
+	  #endif
+	}
+
+	return list;
+}
+
+void pathResetInstrumentation()
+{
+  #ifdef PATH_UTIL_INSTRUMENTATION
+	// Counters are owned by their threads and can't be cleared from here; remember the current values instead
+	// and subtract them from subsequent snapshots.
+	PathInstrumentationRegistry & registry = pathInstrumentationRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	for (size_t op = 0; op < PathOp_Count; op++)
+	{
+		for (size_t i = 0; i < CountersPerOperation; i++)
+		{
+			uint64_t value = registry.retired[op][i];
+			for (PathThreadCounters * counters : registry.threads)
+				value += counters->values[op][i].load(std::memory_order_relaxed);
+			registry.baseline[op][i] = value;
+		}
+	}
+  #endif
+}
+
+std::string pathFormatInstrumentationSnapshot(const PathOperationStatsList & stats)
+{
+	std::stringstream ss;
+
+	struct Counter { const char * name; uint64_t PathOperationStats::* field; };
+	static const Counter counters[] = {
+		{ "path_util_calls_total", &PathOperationStats::calls },
+		{ "path_util_syscalls_total", &PathOperationStats::syscalls },
+		{ "path_util_bytes_total", &PathOperationStats::bytes },
+		{ "path_util_entries_total", &PathOperationStats::entries },
+	};
+
+	for (const Counter & counter : counters)
+	{
+		ss << "# TYPE " << counter.name << " counter\n";
+		for (const PathOperationStats & op : stats)
+			ss << counter.name << "{op=\"" << op.name << "\"} " << op.*counter.field << '\n';
+	}
+
+	ss << "# TYPE path_util_latency_seconds histogram\n";
+	for (const PathOperationStats & op : stats)
+	{
+		uint64_t cumulative = 0;
+		for (size_t i = 0; i < PathLatencyBucketCount; i++)
+		{
+			cumulative += op.latencyHistogram[i];
+			ss << "path_util_latency_seconds_bucket{op=\"" << op.name << "\",le=\"";
+			if (i + 1 < PathLatencyBucketCount)
+				ss << static_cast<double>(uint64_t(1) << (i + 1)) * 1e-9;
+			else
+				ss << "+Inf";
+			ss << "\"} " << cumulative << '\n';
+		}
+		ss << "path_util_latency_seconds_sum{op=\"" << op.name << "\"} "
+			<< static_cast<double>(op.nanoseconds) * 1e-9 << '\n';
+		ss << "path_util_latency_seconds_count{op=\"" << op.name << "\"} " << op.calls << '\n';
+	}
+
+	return ss.str();
+}
@@ -0,0 +1,91 @@
+/* vim: set ai noet ts=4 sw=4 tw=115: */
+//
+// Copyright (c) 2014 Nikolay Zapolnov (zapolnov@gmail.com).
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#ifndef __c80efdc4f458dfbd6f7ce5cb86212d6a__
+#define __c80efdc4f458dfbd6f7ce5cb86212d6a__
+
+#include "path-util.h"
+
+#ifdef PATH_UTIL_INSTRUMENTATION
+
+#include <chrono>
+
+// Only the outermost scope on a thread records anything. Public functions call each other internally, and nested
+// scopes would count the same call several times and split its syscalls between them; instead, all work done
+// below the outermost scope is attributed to it.
+class PathOperationScope
+{
+public:
+	explicit PathOperationScope(PathOperation op);
+	~PathOperationScope();
+
+	void addSyscalls(uint64_t count) { m_syscalls += count; }
+	void addBytes(uint64_t count) { m_bytes += count; }
+	void addEntries(uint64_t count) { m_entries += count; }
+
+private:
+	PathOperation m_operation;
+	bool m_outermost;
+	uint64_t m_syscalls;
+	uint64_t m_bytes;
+	uint64_t m_entries;
+	std::chrono::steady_clock::time_point m_start;
+
+	PathOperationScope(const PathOperationScope &) = delete;
+	PathOperationScope & operator=(const PathOperationScope &) = delete;
+};
+
+extern thread_local PathOperationScope * g_pathCurrentOperation;
+
+inline void pathInstrumentationAddSyscalls(uint64_t count)
+{
+	if (g_pathCurrentOperation)
+		g_pathCurrentOperation->addSyscalls(count);
+}
+
+inline void pathInstrumentationAddBytes(uint64_t count)
+{
+	if (g_pathCurrentOperation)
+		g_pathCurrentOperation->addBytes(count);
+}
+
+inline void pathInstrumentationAddEntries(uint64_t count)
+{
+	if (g_pathCurrentOperation)
+		g_pathCurrentOperation->addEntries(count);
+}
+
+#define PATH_UTIL_OPERATION(OP) PathOperationScope pathOperationScope_(OP)
+#define PATH_UTIL_COUNT_SYSCALLS(N) pathInstrumentationAddSyscalls(N)
+#define PATH_UTIL_COUNT_BYTES(N) pathInstrumentationAddBytes(N)
+#define PATH_UTIL_COUNT_ENTRIES(N) pathInstrumentationAddEntries(N)
+
+#else
+
+#define PATH_UTIL_OPERATION(OP) ((void)0)
+#define PATH_UTIL_COUNT_SYSCALLS(N) ((void)0)
+#define PATH_UTIL_COUNT_BYTES(N) ((void)0)
+#define PATH_UTIL_COUNT_ENTRIES(N) ((void)0)
+
+#endif
+
+#endif
@@ -21,12 +21,18 @@
 // THE SOFTWARE.
 //
 #include "path-util.h"
+#include "path-util-instrumentation.h"
 #include <sstream>
 #include <stdexcept>
 #include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <vector>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <unordered_map>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -38,6 +44,7 @@
 
 #ifndef _WIN32
  #include <unistd.h>
+ #include <fcntl.h>
  #include <pwd.h>
  #include <sys/types.h>
  #ifdef __APPLE__
@@ -55,34 +62,452 @@
  #include <userenv.h>
 #endif
 
-std::string pathToNativeSeparators(const std::string & path)
+#ifndef _WIN32
+static const size_t PathBufferSize = (PATH_MAX > 2048 ? PATH_MAX : 2048);
+
+// Both write into a caller-provided buffer of PathBufferSize bytes, so that callers can keep it on the stack.
+
+static const char * pathGetCurrentDirectory(char (& buf)[PathBufferSize])
+{
+	PATH_UTIL_COUNT_SYSCALLS(1);
+	if (!getcwd(buf, sizeof(buf)))
+	{
+		int err = errno;
+		std::stringstream ss;
+		ss << "unable to determine current directory: " << strerror(err);
+		throw std::runtime_error(ss.str());
+	}
+	return buf;
+}
+
+static const char * pathMakeCanonical(const char * path, char (& buf)[PathBufferSize])
+{
+	PATH_UTIL_COUNT_SYSCALLS(1);
+	if (!realpath(path, buf))
+	{
+		int err = errno;
+		std::stringstream ss;
+		ss << "unable to canonicalize path '" << path << "': " << strerror(err);
+		throw std::runtime_error(ss.str());
+	}
+	return buf;
+}
+#endif
+
+struct PathPart
+{
+	size_t offset;
+	size_t length;
+};
+
+static bool pathIsWin32PathWithDriveLetter(const char * path, size_t length)
+{
+	return (length >= 2 && path[1] == ':' && pathIsWin32DriveLetter(path[0]));
+}
+
+static size_t pathIndexOfFirstSeparator(const char * path, size_t length, size_t start)
+{
+	for (size_t i = start; i < length; i++)
+	{
+		if (pathIsSeparator(path[i]))
+			return i;
+	}
+	return std::string::npos;
+}
+
+size_t pathIndexOfFileName(const char * path, size_t length)
+{
+	for (size_t i = length; i > 0; i--)
+	{
+		if (pathIsSeparator(path[i - 1]))
+			return i;
+	}
+
+  #ifdef _WIN32
+	if (pathIsWin32PathWithDriveLetter(path, length))
+		return 2;
+  #endif
+
+	return 0;
+}
+
+size_t pathIndexOfFullFileExtension(const char * path, size_t length)
+{
+	size_t offset = pathIndexOfFileName(path, length);
+	const void * dot = memchr(path + offset, '.', length - offset);
+	return (dot ? static_cast<size_t>(static_cast<const char *>(dot) - path) : std::string::npos);
+}
+
+static bool pathPartEquals(const char * path, const PathPart & part, const char * str, size_t length)
+{
+	return (part.length == length && memcmp(path + part.offset, str, length) == 0);
+}
+
+// Returns length of the root prefix of the path ("/", "~/", "C:", "C:\", "\\server\"), including the trailing
+// separator if any.
+static size_t pathRootLength(const char * path, size_t length)
 {
   #ifndef _WIN32
-	return path;
+	if (length > 0 && path[0] == '~')
+	{
+		if (length == 1)
+			return 1;
+		return (pathIsSeparator(path[1]) ? 2 : 0);
+	}
+	return (length > 0 && pathIsSeparator(path[0]) ? 1 : 0);
   #else
-	std::string result = path;
+	if (length >= 2 && path[0] == path[1] && pathIsSeparator(path[0]))
+	{
+		size_t pos = pathIndexOfFirstSeparator(path, length, 2);
+		return (pos == std::string::npos ? length : pos + 1);
+	}
+	if (pathIsWin32PathWithDriveLetter(path, length))
+		return (length > 2 && pathIsSeparator(path[2]) ? 3 : 2);
+	return (length > 0 && pathIsSeparator(path[0]) ? 1 : 0);
+  #endif
+}
+
+// Advances to the next component of the path, skipping empty and "." components.
+static bool pathNextComponent(const char * path, size_t length, size_t & off, PathPart & part)
+{
+	while (off < length)
+	{
+		size_t pos = pathIndexOfFirstSeparator(path, length, off);
+		if (pos == std::string::npos)
+			pos = length;
+
+		part.offset = off;
+		part.length = pos - off;
+		off = (pos < length ? pos + 1 : length);
+
+		if (part.length > 0 && !pathPartEquals(path, part, ".", 1))
+			return true;
+	}
+	return false;
+}
+
+static inline char pathFoldChar(char ch)
+{
+	if (pathIsSeparator(ch))
+		return '/';
+  #ifdef _WIN32
+	if (ch >= 'A' && ch <= 'Z')
+		return ch - 'A' + 'a';
+  #endif
+	return ch;
+}
+
+static bool pathRangesEqual(const char * str1, const char * str2, size_t length)
+{
+	for (size_t i = 0; i < length; i++)
+	{
+		if (pathFoldChar(str1[i]) != pathFoldChar(str2[i]))
+			return false;
+	}
+	return true;
+}
+
+static bool pathComponentsEqual(const char * path1, const PathPart & part1, const char * path2, const PathPart & part2)
+{
+	return (part1.length == part2.length && pathRangesEqual(path1 + part1.offset, path2 + part2.offset, part1.length));
+}
+
+static bool pathRootsEqual(const char * path1, size_t root1, const char * path2, size_t root2)
+{
+  #ifndef _WIN32
+	// "~" and "~/" denote the same directory.
+	if (root1 > 0 && root2 > 0 && path1[0] == '~' && path2[0] == '~')
+		return true;
+  #endif
+	return (root1 == root2 && pathRangesEqual(path1, path2, root1));
+}
+
+// The string manipulation functions below are templates over the result string type, so that the same
+// code produces both std::string and std::pmr::string (see path-util.h).
+
+template <class String>
+static String pathToNativeSeparators(const char * path, size_t length, const typename String::allocator_type & alloc)
+{
+	String result(path, length, alloc);
+
+  #ifdef _WIN32
 	for (char & ch : result)
 	{
 		if (ch == '/')
 			ch = '\\';
 	}
-	return result;
   #endif
+
+	return result;
 }
 
-std::string pathToUnixSeparators(const std::string & path)
+template <class String>
+static String pathToUnixSeparators(const char * path, size_t length, const typename String::allocator_type & alloc)
 {
-  #ifndef _WIN32
-	return path;
-  #else
-	std::string result = path;
+	String result(path, length, alloc);
+
+  #ifdef _WIN32
 	for (char & ch : result)
 	{
 		if (ch == '\\')
 			ch = '/';
 	}
+  #endif
+
+	return result;
+}
+
+template <class String>
+static String pathSimplify(const char * path, size_t length, const typename String::allocator_type & alloc)
+{
+	typedef typename std::allocator_traits<typename String::allocator_type>::template rebind_alloc<PathPart>
+		PartAllocator;
+
+	std::vector<PathPart, PartAllocator> parts{PartAllocator(alloc)};
+	String result(alloc);
+
+  #ifdef _WIN32
+	if (length >= 2 && path[0] == path[1] && pathIsSeparator(path[0])
+			&& pathIndexOfFirstSeparator(path, length, 2) == std::string::npos)
+		return pathToNativeSeparators<String>(path, length, alloc);
+  #endif
+
+	size_t off = pathRootLength(path, length);
+	if (off > 0 && pathIsSeparator(path[off - 1]))
+	{
+		result.append(path, off - 1);
+		result += pathSeparator();
+	}
+	else
+		result.append(path, off);
+
+	for (;;)
+	{
+		size_t pos = pathIndexOfFirstSeparator(path, length, off);
+
+		PathPart part;
+		part.offset = off;
+		part.length = (pos == std::string::npos ? length : pos) - off;
+
+		if (pos == std::string::npos)
+		{
+			if (part.length > 0)
+				parts.push_back(part);
+			break;
+		}
+
+		off = pos + 1;
+
+		if (part.length > 0 && !pathPartEquals(path, part, ".", 1))
+		{
+			if (pathPartEquals(path, part, "..", 2) && parts.size() > 0 && !pathPartEquals(path, parts.back(), "..", 2))
+				parts.pop_back();
+			else
+				parts.push_back(part);
+		}
+	}
+
+	const char * prefix = "";
+	for (const PathPart & part : parts)
+	{
+		result += prefix;
+		result.append(path + part.offset, part.length);
+		prefix = pathSeparator();
+	}
+
+	return result;
+}
+
+template <class String>
+static String pathConcat(const char * path1, size_t length1, const char * path2, size_t length2,
+	const typename String::allocator_type & alloc)
+{
+	String result(alloc);
+	result.reserve(length1 + length2 + 1);
+	result.append(path1, length1);
+	if (length1 > 0 && length2 > 0 && !pathIsSeparator(path1[length1 - 1]))
+		result += pathSeparator();
+	result.append(path2, length2);
+	return result;
+}
+
+template <class String>
+static String pathGetUserHomeDirectory(const typename String::allocator_type & alloc)
+{
+  #ifndef _WIN32
+	const char * env = getenv("HOME");
+	if (env)
+		return String(env, alloc);
+
+	PATH_UTIL_COUNT_SYSCALLS(1);
+	struct passwd * pw = getpwuid(getuid());
+	if (pw && pw->pw_dir && pw->pw_dir[0])
+		return String(pw->pw_dir, alloc);
+
+	throw std::runtime_error("unable to determine path to the user home directory.");
+  #else
+	std::string home = pathGetUserHomeDirectory();
+	return String(home.data(), home.length(), alloc);
+  #endif
+}
+
+template <class String>
+static String pathMakeAbsolute(const char * path, size_t length, const char * basePath, size_t baseLength,
+	const typename String::allocator_type & alloc)
+{
+  #ifndef _WIN32
+	if (length >= 1 && path[0] == '~')
+	{
+		if (length == 1)
+		{
+			return pathGetUserHomeDirectory<String>(alloc);
+		}
+		else if (pathIsSeparator(path[1]))
+		{
+			String home = pathGetUserHomeDirectory<String>(alloc);
+			String full = pathConcat<String>(home.data(), home.length(), path + 2, length - 2, alloc);
+			return pathSimplify<String>(full.data(), full.length(), alloc);
+		}
+	}
+	if (length > 0 && pathIsSeparator(path[0]))
+		return pathSimplify<String>(path, length, alloc);
+  #else
+	if (pathIsWin32PathWithDriveLetter(path, length) || (length > 0 && pathIsSeparator(path[0])))
+	{
+		std::string absolute = pathMakeAbsolute(std::string(path, length));
+		return String(absolute.data(), absolute.length(), alloc);
+	}
+  #endif
+
+	String full = pathConcat<String>(basePath, baseLength, path, length, alloc);
+	return pathSimplify<String>(full.data(), full.length(), alloc);
+}
+
+template <class String>
+static String pathGetDirectory(const char * path, size_t length, const typename String::allocator_type & alloc)
+{
+	size_t pos = pathIndexOfFileName(path, length);
+	if (pos > 0)
+		--pos;
+	return String(path, pos, alloc);
+}
+
+template <class String>
+static String pathGetFileName(const char * path, size_t length, const typename String::allocator_type & alloc)
+{
+	size_t pos = pathIndexOfFileName(path, length);
+	return String(path + pos, length - pos, alloc);
+}
+
+template <class String>
+static String pathGetShortFileExtension(const char * path, size_t length,
+	const typename String::allocator_type & alloc)
+{
+	size_t offset = pathIndexOfFileName(path, length);
+	for (size_t pos = length; pos > offset; pos--)
+	{
+		if (path[pos - 1] == '.')
+			return String(path + pos - 1, length - pos + 1, alloc);
+	}
+	return String(alloc);
+}
+
+template <class String>
+static String pathGetFullFileExtension(const char * path, size_t length,
+	const typename String::allocator_type & alloc)
+{
+	size_t pos = pathIndexOfFullFileExtension(path, length);
+	return (pos == std::string::npos ? String(alloc) : String(path + pos, length - pos, alloc));
+}
+
+template <class String>
+static String pathReplaceFullFileExtension(const char * path, size_t length, const char * ext, size_t extLength,
+	const typename String::allocator_type & alloc)
+{
+	size_t pos = pathIndexOfFullFileExtension(path, length);
+	if (pos == std::string::npos)
+		pos = length;
+
+	String result(alloc);
+	result.reserve(pos + extLength);
+	result.append(path, pos);
+	result.append(ext, extLength);
 	return result;
+}
+
+static DirEntryType pathGetDirEntryType(const struct dirent * ent)
+{
+	switch (ent->d_type)
+	{
+	case DT_REG: return DirEntry_RegularFile;
+	case DT_DIR: return DirEntry_Directory;
+  #ifndef _WIN32
+	case DT_FIFO: return DirEntry_FIFO;
+	case DT_SOCK: return DirEntry_Socket;
+	case DT_CHR: return DirEntry_CharDevice;
+	case DT_BLK: return DirEntry_BlockDevice;
+	case DT_LNK: return DirEntry_Link;
   #endif
+	default: return DirEntry_Unknown;
+	}
+}
+
+template <class List>
+static List pathEnumDirectoryContents(const char * path, const typename List::allocator_type & alloc)
+{
+	typedef typename List::value_type Entry;
+	typedef decltype(Entry::name) Name;
+
+	List list(alloc);
+	DIR * dir;
+
+	PATH_UTIL_COUNT_SYSCALLS(2);
+	dir = opendir(path);
+	if (!dir)
+	{
+		int err = errno;
+		std::stringstream ss;
+		ss << "unable to enumerate contents of directory '" << path << "': " << strerror(err);
+		throw std::runtime_error(ss.str());
+	}
+
+	try
+	{
+		struct dirent * ent;
+		while ((ent = readdir(dir)) != nullptr)
+		{
+			const char * name = ent->d_name;
+			if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+				continue;
+
+			Entry entry = { pathGetDirEntryType(ent), Name(name, typename Name::allocator_type(alloc)) };
+			list.push_back(std::move(entry));
+		}
+	}
+	catch (...)
+	{
+		closedir(dir);
+		throw;
+	}
+
+	closedir(dir);
+
+	PATH_UTIL_COUNT_ENTRIES(list.size());
+	return list;
+}
+
+std::string pathToNativeSeparators(const std::string & path)
+{
+	PATH_UTIL_OPERATION(PathOp_ToNativeSeparators);
+	PATH_UTIL_COUNT_BYTES(path.length());
+	return pathToNativeSeparators<std::string>(path.data(), path.length(), std::allocator<char>());
+}
+
+std::string pathToUnixSeparators(const std::string & path)
+{
+	PATH_UTIL_OPERATION(PathOp_ToUnixSeparators);
+	PATH_UTIL_COUNT_BYTES(path.length());
+	return pathToUnixSeparators<std::string>(path.data(), path.length(), std::allocator<char>());
 }
 
 const char * pathSeparator()
@@ -113,22 +538,17 @@ bool pathIsWin32DriveLetter(char ch)
 
 bool pathIsWin32PathWithDriveLetter(const std::string & path)
 {
-	return (path.length() >= 2 && path[1] == ':' && pathIsWin32DriveLetter(path[0]));
+	return pathIsWin32PathWithDriveLetter(path.data(), path.length());
 }
 
 std::string pathGetCurrentDirectory()
 {
+	PATH_UTIL_OPERATION(PathOp_GetCurrentDirectory);
   #ifndef _WIN32
-	std::vector<char> buf(std::max(static_cast<size_t>(PATH_MAX), static_cast<size_t>(2048)));
-	if (!getcwd(buf.data(), buf.size()))
-	{
-		int err = errno;
-		std::stringstream ss;
-		ss << "unable to determine current directory: " << strerror(err);
-		throw std::runtime_error(ss.str());
-	}
-	return buf.data();
+	char buf[PathBufferSize];
+	return pathGetCurrentDirectory(buf);
   #else
+	PATH_UTIL_COUNT_SYSCALLS(2);
 	DWORD size = GetCurrentDirectoryA(0, nullptr);
 	if (size == 0)
 	{
@@ -152,19 +572,13 @@ std::string pathGetCurrentDirectory()
 
 std::string pathGetUserHomeDirectory()
 {
+	PATH_UTIL_OPERATION(PathOp_GetUserHomeDirectory);
   #ifndef _WIN32
-	const char * env = getenv("HOME");
-	if (env)
-		return env;
-
-	struct passwd * pw = getpwuid(getuid());
-	if (pw && pw->pw_dir && pw->pw_dir[0])
-		return pw->pw_dir;
-
-	throw std::runtime_error("unable to determine path to the user home directory.");
+	return pathGetUserHomeDirectory<std::string>(std::allocator<char>());
   #else
 	std::string result;
 	HANDLE hToken = nullptr;
+	PATH_UTIL_COUNT_SYSCALLS(3);
 	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &hToken))
 	{
 		DWORD err = GetLastError();
@@ -197,6 +611,8 @@ std::string pathGetUserHomeDirectory()
 
 bool pathIsAbsolute(const std::string & path)
 {
+	PATH_UTIL_OPERATION(PathOp_IsAbsolute);
+	PATH_UTIL_COUNT_BYTES(path.length());
   #ifndef _WIN32
 	if (path.length() >= 1 && path[0] == '~')
 		return (path.length() == 1 || pathIsSeparator(path[1]));
@@ -210,29 +626,19 @@ bool pathIsAbsolute(const std::string & path)
 
 std::string pathMakeAbsolute(const std::string & path, const std::string & basePath)
 {
-  #ifndef _WIN32
-	if (path.length() >= 1 && path[0] == '~')
-	{
-		if (path.length() == 1)
-			return pathGetUserHomeDirectory();
-		else if (pathIsSeparator(path[1]))
-			return pathSimplify(pathConcat(pathGetUserHomeDirectory(), path.substr(2)));
-	}
-	if (pathIsSeparator(path[0]))
-		return pathSimplify(path);
-  #else
-	if (pathIsWin32PathWithDriveLetter(path) || (path.length() > 0 && pathIsSeparator(path[0])))
-		return pathMakeAbsolute(path);
-  #endif
-
-	return pathSimplify(pathConcat(basePath, path));
+	PATH_UTIL_OPERATION(PathOp_MakeAbsolute);
+	PATH_UTIL_COUNT_BYTES(path.length());
+	return pathMakeAbsolute<std::string>(path.data(), path.length(), basePath.data(), basePath.length(),
+		std::allocator<char>());
 }
 
 std::string pathMakeAbsolute(const std::string & path)
 {
+	PATH_UTIL_OPERATION(PathOp_MakeAbsolute);
   #ifndef _WIN32
 	return pathMakeAbsolute(path, pathGetCurrentDirectory());
   #else
+	PATH_UTIL_COUNT_SYSCALLS(2);
 	DWORD size = GetFullPathNameA(path.c_str(), 0, nullptr, nullptr);
 	if (size == 0)
 	{
@@ -256,185 +662,302 @@ std::string pathMakeAbsolute(const std::string & path)
 
 size_t pathIndexOfFirstSeparator(const std::string & path, size_t start)
 {
-	size_t pos = path.find('/', start);
-
-  #ifdef _WIN32
-	size_t pos2 = path.find('\\', start);
-	if (pos2 != std::string::npos && (pos == std::string::npos || pos2 < pos))
-		pos = pos2;
-  #endif
-
-	return pos;
+	return pathIndexOfFirstSeparator(path.data(), path.length(), start);
 }
 
 std::string pathSimplify(const std::string & path)
 {
-	std::vector<std::string> parts;
-	std::stringstream ss;
-	size_t off = 0;
+	PATH_UTIL_OPERATION(PathOp_Simplify);
+	PATH_UTIL_COUNT_BYTES(path.length());
+	return pathSimplify<std::string>(path.data(), path.length(), std::allocator<char>());
+}
 
+std::string pathMakeCanonical(const std::string & path)
+{
+	PATH_UTIL_OPERATION(PathOp_MakeCanonical);
+	PATH_UTIL_COUNT_BYTES(path.length());
   #ifndef _WIN32
-	if (path.length() > 0 && path[0] == '~')
-	{
-		if (path.length() == 1)
-			return path;
-		else if (pathIsSeparator(path[1]))
-		{
-			ss << '~' << pathSeparator();
-			off = 2;
-		}
-	}
-	else if (path.length() > 0 && pathIsSeparator(path[0]))
-	{
-		off = 1;
-		ss << pathSeparator();
-	}
+	char buf[PathBufferSize];
+	return pathMakeCanonical(path.c_str(), buf);
   #else
-	if (path.length() >= 2 && path[0] == path[1] && pathIsSeparator(path[0]))
-	{
-		off = pathIndexOfFirstSeparator(path, 2);
-		if (off == std::string::npos)
-			return pathToNativeSeparators(path);
-		ss << path.substr(0, off) << pathSeparator();
-		++off;
-	}
-	else if (pathIsWin32PathWithDriveLetter(path))
+	return pathMakeAbsolute(path);
+  #endif
+}
+
+std::string pathConcat(const std::string & path1, const std::string & path2)
+{
+	PATH_UTIL_OPERATION(PathOp_Concat);
+	PATH_UTIL_COUNT_BYTES(path1.length() + path2.length());
+	return pathConcat<std::string>(path1.data(), path1.length(), path2.data(), path2.length(),
+		std::allocator<char>());
+}
+
+size_t pathIndexOfFileName(const std::string & path)
+{
+	return pathIndexOfFileName(path.data(), path.length());
+}
+
+std::string pathGetDirectory(const std::string & path)
+{
+	PATH_UTIL_OPERATION(PathOp_GetDirectory);
+	PATH_UTIL_COUNT_BYTES(path.length());
+	return pathGetDirectory<std::string>(path.data(), path.length(), std::allocator<char>());
+}
+
+std::string pathGetFileName(const std::string & path)
+{
+	PATH_UTIL_OPERATION(PathOp_GetFileName);
+	PATH_UTIL_COUNT_BYTES(path.length());
+	return pathGetFileName<std::string>(path.data(), path.length(), std::allocator<char>());
+}
+
+std::string pathGetShortFileExtension(const std::string & path)
+{
+	PATH_UTIL_OPERATION(PathOp_GetShortFileExtension);
+	PATH_UTIL_COUNT_BYTES(path.length());
+	return pathGetShortFileExtension<std::string>(path.data(), path.length(), std::allocator<char>());
+}
+
+std::string pathGetFullFileExtension(const std::string & path)
+{
+	PATH_UTIL_OPERATION(PathOp_GetFullFileExtension);
+	PATH_UTIL_COUNT_BYTES(path.length());
+	return pathGetFullFileExtension<std::string>(path.data(), path.length(), std::allocator<char>());
+}
+
+std::string pathReplaceFullFileExtension(const std::string & path, const std::string & ext)
+{
+	PATH_UTIL_OPERATION(PathOp_ReplaceFullFileExtension);
+	PATH_UTIL_COUNT_BYTES(path.length() + ext.length());
+	return pathReplaceFullFileExtension<std::string>(path.data(), path.length(), ext.data(), ext.length(),
+		std::allocator<char>());
+}
+
+static bool pathIsUnder(const char * path, size_t length, const char * dir, size_t dirLength)
+{
+	size_t root = pathRootLength(path, length);
+	size_t dirRoot = pathRootLength(dir, dirLength);
+	if (!pathRootsEqual(path, root, dir, dirRoot))
+		return false;
+
+	size_t off = root, dirOff = dirRoot;
+	PathPart part, dirPart;
+	while (pathNextComponent(dir, dirLength, dirOff, dirPart))
 	{
-		off = 2;
-		ss << path.substr(0, off);
-		if (path.length() > 2 && pathIsSeparator(path[2]))
-		{
-			++off;
-			ss << pathSeparator();
-		}
+		if (!pathNextComponent(path, length, off, part) || !pathComponentsEqual(path, part, dir, dirPart))
+			return false;
 	}
-	else if (path.length() > 0 && pathIsSeparator(path[0]))
+
+	return true;
+}
+
+static size_t pathCommonPrefixLength(const char * path1, size_t length1, const char * path2, size_t length2)
+{
+	size_t root1 = pathRootLength(path1, length1);
+	size_t root2 = pathRootLength(path2, length2);
+	if (!pathRootsEqual(path1, root1, path2, root2))
+		return 0;
+
+	size_t off1 = root1, off2 = root2, result = root1;
+	PathPart part1, part2;
+	while (pathNextComponent(path1, length1, off1, part1) && pathNextComponent(path2, length2, off2, part2))
 	{
-		off = 1;
-		ss << pathSeparator();
+		if (!pathComponentsEqual(path1, part1, path2, part2))
+			break;
+		result = part1.offset + part1.length;
 	}
-  #endif
 
+	return result;
+}
+
+std::string pathMakeRelative(const std::string & path, const std::string & basePath)
+{
+	PATH_UTIL_OPERATION(PathOp_MakeRelative);
+	PATH_UTIL_COUNT_BYTES(path.length() + basePath.length());
+
+	const char * p = path.data();
+	const char * b = basePath.data();
+	size_t root = pathRootLength(p, path.length());
+	size_t baseRoot = pathRootLength(b, basePath.length());
+	if (!pathRootsEqual(p, root, b, baseRoot))
+		return path;
+
+	size_t off = root, baseOff = baseRoot;
+	PathPart part = { 0, 0 }, basePart = { 0, 0 };
+	bool hasPart, hasBasePart;
 	for (;;)
 	{
-		size_t pos = pathIndexOfFirstSeparator(path, off);
-		if (pos == std::string::npos)
-		{
-			std::string part = path.substr(off);
-			if (part.length() > 0)
-				parts.push_back(part);
+		hasPart = pathNextComponent(p, path.length(), off, part);
+		hasBasePart = pathNextComponent(b, basePath.length(), baseOff, basePart);
+		if (!hasPart || !hasBasePart || !pathComponentsEqual(p, part, b, basePart))
 			break;
-		}
-
-		std::string part = path.substr(off, pos - off);
-		off = pos + 1;
+	}
 
-		if (part.length() > 0 && part != ".")
+	size_t up = 0;
+	for (; hasBasePart; hasBasePart = pathNextComponent(b, basePath.length(), baseOff, basePart))
+	{
+		if (pathPartEquals(b, basePart, "..", 2))
 		{
-			if (part == ".." && parts.size() > 0 && parts.back() != "..")
-				parts.pop_back();
-			else
-				parts.push_back(part);
+			std::stringstream ss;
+			ss << "unable to make path '" << path << "' relative to '" << basePath << "'.";
+			throw std::runtime_error(ss.str());
 		}
+		++up;
 	}
 
+	std::string result;
+	result.reserve(up * 3 + (hasPart ? path.length() - part.offset : 0));
+
 	const char * prefix = "";
-	for (const std::string & part : parts)
+	for (size_t i = 0; i < up; i++)
 	{
-		ss << prefix << part;
+		result += prefix;
+		result += "..";
+		prefix = pathSeparator();
+	}
+	for (; hasPart; hasPart = pathNextComponent(p, path.length(), off, part))
+	{
+		result += prefix;
+		result.append(p + part.offset, part.length);
 		prefix = pathSeparator();
 	}
 
-	return ss.str();
+	if (result.length() == 0)
+		result += '.';
+
+	return result;
 }
 
-std::string pathMakeCanonical(const std::string & path)
+bool pathIsUnder(const std::string & path, const std::string & dir)
 {
-  #ifndef _WIN32
-	std::vector<char> buf(std::max(static_cast<size_t>(PATH_MAX), static_cast<size_t>(2048)));
-	if (!realpath(path.c_str(), buf.data()))
-	{
-		int err = errno;
-		std::stringstream ss;
-		ss << "unable to canonicalize path '" << path << "': " << strerror(err);
-		throw std::runtime_error(ss.str());
-	}
-	return buf.data();
-  #else
-	return pathMakeAbsolute(path);
-  #endif
+	PATH_UTIL_OPERATION(PathOp_IsUnder);
+	PATH_UTIL_COUNT_BYTES(path.length() + dir.length());
+	return pathIsUnder(path.data(), path.length(), dir.data(), dir.length());
 }
 
-std::string pathConcat(const std::string & path1, const std::string & path2)
+size_t pathCommonPrefixLength(const std::string & path1, const std::string & path2)
 {
-	if (path1.length() == 0)
-		return path2;
-	if (path2.length() == 0)
-		return path1;
-
-	if (pathIsSeparator(path1[path1.length() - 1]))
-		return path1 + path2;
-	else
-		return path1 + pathSeparator() + path2;
+	PATH_UTIL_OPERATION(PathOp_CommonPrefix);
+	PATH_UTIL_COUNT_BYTES(path1.length() + path2.length());
+	return pathCommonPrefixLength(path1.data(), path1.length(), path2.data(), path2.length());
 }
 
-size_t pathIndexOfFileName(const std::string & path)
+std::string pathCommonPrefix(const std::vector<std::string> & paths)
 {
-	size_t pos = path.rfind('/');
+	PATH_UTIL_OPERATION(PathOp_CommonPrefix);
+	PATH_UTIL_COUNT_ENTRIES(paths.size());
 
-  #ifdef _WIN32
-	size_t pos2 = path.rfind('\\');
-	if (pos2 != std::string::npos && (pos == std::string::npos || pos2 > pos))
-		pos = pos2;
-	if (pos == std::string::npos && pathIsWin32PathWithDriveLetter(path))
-		pos = 1;
-  #endif
+	if (paths.empty())
+		return std::string();
 
-	return (pos != std::string::npos ? pos + 1 : 0);
-}
+	const std::string & first = paths[0];
+	size_t length = first.length();
+	for (size_t i = 1; i < paths.size() && length > 0; i++)
+	{
+		PATH_UTIL_COUNT_BYTES(paths[i].length());
+		length = pathCommonPrefixLength(first.data(), length, paths[i].data(), paths[i].length());
+	}
 
-std::string pathGetDirectory(const std::string & path)
-{
-	size_t pos = pathIndexOfFileName(path);
-	if (pos > 0)
-		--pos;
-	return path.substr(0, pos);
+	return first.substr(0, length);
 }
 
-std::string pathGetFileName(const std::string & path)
+// FNV-1a over case- and separator-folded bytes; components are delimited with '/' so that "a/bc" and "ab/c"
+// hash differently.
+static const uint64_t PathHashSeed = 14695981039346656037ULL;
+
+static uint64_t pathHashBytes(uint64_t hash, const char * data, size_t length)
 {
-	return path.substr(pathIndexOfFileName(path));
+	for (size_t i = 0; i < length; i++)
+	{
+		hash ^= static_cast<unsigned char>(pathFoldChar(data[i]));
+		hash *= 1099511628211ULL;
+	}
+	return hash;
 }
 
-std::string pathGetShortFileExtension(const std::string & path)
+static uint64_t pathHashRoot(const char * path, size_t root)
 {
-	size_t pos = path.rfind('.');
-	if (pos == std::string::npos)
-		return std::string();
-
-	size_t offset = pathIndexOfFileName(path);
-	if (pos < offset)
-		return std::string();
-
-	return path.substr(pos);
+  #ifndef _WIN32
+	if (root > 0 && path[0] == '~')
+		return pathHashBytes(PathHashSeed, "~/", 2);
+  #endif
+	return pathHashBytes(PathHashSeed, path, root);
 }
 
-std::string pathGetFullFileExtension(const std::string & path)
+static uint64_t pathHashComponent(uint64_t hash, const char * path, const PathPart & part)
 {
-	size_t offset = pathIndexOfFileName(path);
-	size_t pos = path.find('.', offset);
-	return (pos == std::string::npos ? std::string() : path.substr(pos));
+	return pathHashBytes(pathHashBytes(hash, "/", 1), path + part.offset, part.length);
 }
 
-std::string pathReplaceFullFileExtension(const std::string & path, const std::string & ext)
+std::vector<size_t> pathFindContainingRoots(const std::vector<std::string> & paths,
+	const std::vector<std::string> & roots)
 {
-	size_t offset = pathIndexOfFileName(path);
-	size_t pos = path.find('.', offset);
-	return (pos == std::string::npos ? path + ext : path.substr(0, pos) + ext);
+	PATH_UTIL_OPERATION(PathOp_FindContainingRoots);
+	PATH_UTIL_COUNT_ENTRIES(paths.size());
+
+	// Index roots by the hash of all of their components. Every prefix of a path can then be looked up in
+	// constant time while walking the path, so each path is processed in a single pass regardless of the
+	// number of roots.
+	std::unordered_multimap<uint64_t, size_t> index;
+	index.reserve(roots.size());
+	for (size_t i = 0; i < roots.size(); i++)
+	{
+		const char * root = roots[i].data();
+		size_t length = roots[i].length();
+		size_t off = pathRootLength(root, length);
+		uint64_t hash = pathHashRoot(root, off);
+
+		PathPart part;
+		while (pathNextComponent(root, length, off, part))
+			hash = pathHashComponent(hash, root, part);
+
+		index.insert(std::make_pair(hash, i));
+	}
+
+	std::vector<size_t> result(paths.size(), std::string::npos);
+	if (index.empty())
+		return result;
+
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		const char * path = paths[i].data();
+		size_t length = paths[i].length();
+		size_t off = pathRootLength(path, length);
+		uint64_t hash = pathHashRoot(path, off);
+
+		PATH_UTIL_COUNT_BYTES(length);
+
+		// Prefixes are visited from the shortest to the longest one, so the last match is the deepest root.
+		size_t match = std::string::npos;
+		for (;;)
+		{
+			size_t depthMatch = std::string::npos;
+			auto range = index.equal_range(hash);
+			for (auto it = range.first; it != range.second; ++it)
+			{
+				const std::string & root = roots[it->second];
+				if (it->second < depthMatch && pathIsUnder(path, length, root.data(), root.length()))
+					depthMatch = it->second;
+			}
+			if (depthMatch != std::string::npos)
+				match = depthMatch;
+
+			PathPart part;
+			if (!pathNextComponent(path, length, off, part))
+				break;
+			hash = pathHashComponent(hash, path, part);
+		}
+
+		result[i] = match;
+	}
+
+	return result;
 }
 
 bool pathCreate(const std::string & path)
 {
+	PATH_UTIL_OPERATION(PathOp_Create);
+
 	std::string dir = pathMakeAbsolute(path);
 	bool result = false;
 	size_t off = 0;
@@ -482,6 +1005,8 @@ bool pathCreate(const std::string & path)
 		else
 			subdir = dir.substr(0, end);
 
+		PATH_UTIL_COUNT_SYSCALLS(1);
+
 	  #ifndef _WIN32
 		if (mkdir(subdir.c_str(), 0755) == 0)
 			result = true;
@@ -517,16 +1042,31 @@ bool pathCreate(const std::string & path)
 
 bool pathIsExistent(const std::string & path)
 {
+	return pathIsExistent(path.c_str());
+}
+
+bool pathIsExistent(const char * path)
+{
+	PATH_UTIL_OPERATION(PathOp_IsExistent);
+	PATH_UTIL_COUNT_SYSCALLS(1);
+
 	struct stat st;
-	int err = stat(path.c_str(), &st);
+	int err = stat(path, &st);
 	return (err == 0);
 }
 
 bool pathIsFile(const std::string & path)
 {
+	return pathIsFile(path.c_str());
+}
+
+bool pathIsFile(const char * path)
+{
+	PATH_UTIL_OPERATION(PathOp_IsFile);
+	PATH_UTIL_COUNT_SYSCALLS(1);
   #ifndef _WIN32
 	struct stat st;
-	int err = stat(path.c_str(), &st);
+	int err = stat(path, &st);
 	if (err < 0)
 	{
 		err = errno;
@@ -538,7 +1078,7 @@ bool pathIsFile(const std::string & path)
 	}
 	return S_ISREG(st.st_mode);
   #else
-	DWORD attr = GetFileAttributesA(path.c_str());
+	DWORD attr = GetFileAttributesA(path);
 	if (attr == INVALID_FILE_ATTRIBUTES)
 	{
 		DWORD err = GetLastError();
@@ -555,8 +1095,16 @@ bool pathIsFile(const std::string & path)
 
 time_t pathGetModificationTime(const std::string & path)
 {
+	return pathGetModificationTime(path.c_str());
+}
+
+time_t pathGetModificationTime(const char * path)
+{
+	PATH_UTIL_OPERATION(PathOp_GetModificationTime);
+	PATH_UTIL_COUNT_SYSCALLS(1);
+
 	struct stat st;
-	int err = stat(path.c_str(), &st);
+	int err = stat(path, &st);
 	if (err < 0)
 	{
 		err = errno;
@@ -569,6 +1117,8 @@ time_t pathGetModificationTime(const std::string & path)
 
 std::string pathGetThisExecutableFile()
 {
+	PATH_UTIL_OPERATION(PathOp_GetThisExecutableFile);
+	PATH_UTIL_COUNT_SYSCALLS(1);
   #ifdef _WIN32
 	char buf[MAX_PATH];
 	if (!GetModuleFileNameA(nullptr, buf, sizeof(buf)))
@@ -632,6 +1182,8 @@ std::string pathGetThisExecutableFile()
 
 std::string pathCreateSymLink(const std::string & from, const std::string & to)
 {
+	PATH_UTIL_OPERATION(PathOp_CreateSymLink);
+	PATH_UTIL_COUNT_SYSCALLS(1);
   #ifdef _WIN32
 	if (!CreateSymbolicLinkA(to.c_str(), from.c_str(), 0))
 	{
@@ -648,6 +1200,7 @@ std::string pathCreateSymLink(const std::string & from, const std::string & to)
 		if (err == EEXIST)
 		{
 			std::vector<char> buf(PATH_MAX + 1);
+			PATH_UTIL_COUNT_SYSCALLS(1);
 			if (readlink(to.c_str(), buf.data(), PATH_MAX) >= 0 && from == buf.data())
 				return to;
 		}
@@ -662,74 +1215,549 @@ std::string pathCreateSymLink(const std::string & from, const std::string & to)
 
 DirEntryList pathEnumDirectoryContents(const std::string & path)
 {
-	DirEntryList list;
-	DIR * dir;
+	PATH_UTIL_OPERATION(PathOp_EnumDirectoryContents);
+	return pathEnumDirectoryContents<DirEntryList>(path.c_str(), std::allocator<DirEntry>());
+}
 
-	dir = opendir(path.c_str());
-	if (!dir)
+void pathDeleteFile(const std::string & path)
+{
+	pathDeleteFile(path.c_str());
+}
+
+void pathDeleteFile(const char * path)
+{
+	PATH_UTIL_OPERATION(PathOp_DeleteFile);
+	PATH_UTIL_COUNT_SYSCALLS(1);
+  #ifndef _WIN32
+	if (unlink(path) < 0)
 	{
 		int err = errno;
 		std::stringstream ss;
-		ss << "unable to enumerate contents of directory '" << path << "': " << strerror(err);
+		ss << "unable to delete file '" << path << "': " << strerror(err);
+		throw std::runtime_error(ss.str());
+	}
+  #else
+	if (!DeleteFileA(path))
+	{
+		DWORD err = GetLastError();
+		std::stringstream ss;
+		ss << "unable to delete file '" << path << "' (code " << err << ").";
 		throw std::runtime_error(ss.str());
 	}
+  #endif
+}
 
-	try
+static const size_t PathWriteGroupSize = 64;
+static const size_t PathWriteFlushThreads = 8;
+
+struct PendingFileWrite
+{
+	std::string path;
+	std::string tempPath;
+  #ifndef _WIN32
+	int fd;
+  #else
+	HANDLE handle;
+  #endif
+	bool renamed;
+};
+
+static std::string pathMakeTempFileName(const std::string & path)
+{
+	static std::atomic<unsigned> counter(0);
+
+  #ifndef _WIN32
+	unsigned long pid = static_cast<unsigned long>(getpid());
+  #else
+	unsigned long pid = static_cast<unsigned long>(GetCurrentProcessId());
+  #endif
+
+	std::stringstream ss;
+	ss << path << ".tmp" << pid << '-' << counter++;
+	return ss.str();
+}
+
+static std::string pathGetDirectoryForSync(const std::string & path)
+{
+	std::string dir = pathGetDirectory<std::string>(path.data(), path.length(), std::allocator<char>());
+	if (dir.length() == 0)
+		return (path.length() > 0 && pathIsSeparator(path[0]) ? pathSeparator() : ".");
+	return dir;
+}
+
+static void pathOpenTempFile(PendingFileWrite & file)
+{
+	file.tempPath = pathMakeTempFileName(file.path);
+	PATH_UTIL_COUNT_SYSCALLS(1);
+
+  #ifndef _WIN32
+	file.fd = open(file.tempPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_TRUNC | O_CLOEXEC, 0666);
+	if (file.fd < 0)
 	{
-		struct dirent * ent;
-		while ((ent = readdir(dir)) != nullptr)
+		int err = errno;
+		std::stringstream ss;
+		ss << "unable to create file '" << file.tempPath << "': " << strerror(err);
+		throw std::runtime_error(ss.str());
+	}
+
+	// A new file gets 0666 minus the umask, like fopen() would create it. A file that is being replaced keeps
+	// its permissions.
+	struct stat st;
+	PATH_UTIL_COUNT_SYSCALLS(1);
+	if (stat(file.path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+	{
+		PATH_UTIL_COUNT_SYSCALLS(1);
+		if (fchmod(file.fd, st.st_mode & 07777) < 0)
 		{
-			DirEntry entry;
+			int err = errno;
+			std::stringstream ss;
+			ss << "unable to set permissions of file '" << file.tempPath << "': " << strerror(err);
+			throw std::runtime_error(ss.str());
+		}
+	}
+  #else
+	file.handle = CreateFileA(file.tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_NEW,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file.handle == INVALID_HANDLE_VALUE)
+	{
+		DWORD err = GetLastError();
+		std::stringstream ss;
+		ss << "unable to create file '" << file.tempPath << "' (code " << err << ").";
+		throw std::runtime_error(ss.str());
+	}
+  #endif
+}
+
+static void pathWriteTempFile(PendingFileWrite & file, const void * data, size_t size)
+{
+	const char * p = static_cast<const char *>(data);
+
+	PATH_UTIL_COUNT_BYTES(size);
+
+	while (size > 0)
+	{
+		PATH_UTIL_COUNT_SYSCALLS(1);
 
-			entry.name = ent->d_name;
-			if (entry.name == "." || entry.name == "..")
+	  #ifndef _WIN32
+		ssize_t written = write(file.fd, p, size);
+		if (written < 0)
+		{
+			int err = errno;
+			if (err == EINTR)
 				continue;
+			std::stringstream ss;
+			ss << "unable to write file '" << file.tempPath << "': " << strerror(err);
+			throw std::runtime_error(ss.str());
+		}
+	  #else
+		DWORD chunk = static_cast<DWORD>(std::min(size, static_cast<size_t>(0x40000000)));
+		DWORD written = 0;
+		if (!WriteFile(file.handle, p, chunk, &written, nullptr))
+		{
+			DWORD err = GetLastError();
+			std::stringstream ss;
+			ss << "unable to write file '" << file.tempPath << "' (code " << err << ").";
+			throw std::runtime_error(ss.str());
+		}
+	  #endif
+		p += written;
+		size -= static_cast<size_t>(written);
+	}
+
+	// Queue the data for writeback right away, so that the fsync pass below mostly waits for I/O that
+	// is already in flight instead of issuing it one file at a time.
+  #if defined(__linux__) && defined(SYNC_FILE_RANGE_WRITE)
+	PATH_UTIL_COUNT_SYSCALLS(1);
+	sync_file_range(file.fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+  #endif
+}
 
-			switch (ent->d_type)
+// Runs on the flush threads of pathSyncTempFiles(), so it must not touch the instrumentation counters.
+static void pathSyncTempFile(PendingFileWrite & file)
+{
+  #ifndef _WIN32
+   #ifdef __linux__
+	int r = fdatasync(file.fd);
+   #else
+	int r = fsync(file.fd);
+   #endif
+	if (r < 0)
+	{
+		int err = errno;
+		std::stringstream ss;
+		ss << "unable to flush file '" << file.tempPath << "': " << strerror(err);
+		throw std::runtime_error(ss.str());
+	}
+  #else
+	if (!FlushFileBuffers(file.handle))
+	{
+		DWORD err = GetLastError();
+		std::stringstream ss;
+		ss << "unable to flush file '" << file.tempPath << "' (code " << err << ").";
+		throw std::runtime_error(ss.str());
+	}
+  #endif
+}
+
+// Flushes files [begin, end) concurrently. A flush that is issued while another one is waiting for the journal
+// gets merged into the next commit, so N concurrent flushes cost a few journal commits instead of N serialized
+// ones. Flushes that fail are reported after all of them have completed.
+static void pathSyncTempFiles(std::vector<PendingFileWrite> & files, size_t begin, size_t end)
+{
+	PATH_UTIL_COUNT_SYSCALLS(end - begin);
+
+	std::vector<std::exception_ptr> errors(end - begin);
+	std::atomic<size_t> next(begin);
+	auto flush = [&files, &errors, &next, begin, end]() {
+		for (size_t i = next.fetch_add(1); i < end; i = next.fetch_add(1))
+		{
+			try
 			{
-			case DT_REG: entry.type = DirEntry_RegularFile; break;
-			case DT_DIR: entry.type = DirEntry_Directory; break;
-		  #ifndef _WIN32
-			case DT_FIFO: entry.type = DirEntry_FIFO; break;
-			case DT_SOCK: entry.type = DirEntry_Socket; break;
-			case DT_CHR: entry.type = DirEntry_CharDevice; break;
-			case DT_BLK: entry.type = DirEntry_BlockDevice; break;
-			case DT_LNK: entry.type = DirEntry_Link; break;
-		  #endif
-			default: entry.type = DirEntry_Unknown; break;
+				pathSyncTempFile(files[i]);
 			}
+			catch (...)
+			{
+				errors[i - begin] = std::current_exception();
+			}
+		}
+	};
 
-			list.push_back(entry);
+	// Running out of threads only makes the flush slower, so failing to start one is not an error.
+	std::vector<std::thread> threads;
+	size_t threadCount = std::min(PathWriteFlushThreads, end - begin);
+	for (size_t i = 1; i < threadCount; i++)
+	{
+		try
+		{
+			threads.emplace_back(flush);
+		}
+		catch (...)
+		{
+			break;
 		}
 	}
-	catch (...)
+
+	flush();
+	for (std::thread & thread : threads)
+		thread.join();
+
+	for (const std::exception_ptr & error : errors)
 	{
-		closedir(dir);
-		throw;
+		if (error)
+			std::rethrow_exception(error);
 	}
+}
 
-	closedir(dir);
+static void pathCloseTempFile(PendingFileWrite & file)
+{
+	PATH_UTIL_COUNT_SYSCALLS(1);
 
-	return list;
+  #ifndef _WIN32
+	int r = close(file.fd);
+	file.fd = -1;
+	if (r < 0)
+	{
+		int err = errno;
+		std::stringstream ss;
+		ss << "unable to close file '" << file.tempPath << "': " << strerror(err);
+		throw std::runtime_error(ss.str());
+	}
+  #else
+	CloseHandle(file.handle);
+	file.handle = INVALID_HANDLE_VALUE;
+  #endif
 }
 
-void pathDeleteFile(const std::string & path)
+static void pathRenameTempFile(PendingFileWrite & file)
 {
+	PATH_UTIL_COUNT_SYSCALLS(1);
+
   #ifndef _WIN32
-	if (unlink(path.c_str()) < 0)
+	if (rename(file.tempPath.c_str(), file.path.c_str()) < 0)
 	{
 		int err = errno;
 		std::stringstream ss;
-		ss << "unable to delete file '" << path << "': " << strerror(err);
+		ss << "unable to rename file '" << file.tempPath << "' to '" << file.path << "': " << strerror(err);
 		throw std::runtime_error(ss.str());
 	}
   #else
-	if (!DeleteFileA(path.c_str()))
+	if (!MoveFileExA(file.tempPath.c_str(), file.path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
 	{
 		DWORD err = GetLastError();
 		std::stringstream ss;
-		ss << "unable to delete file '" << path << "' (code " << err << ").";
+		ss << "unable to rename file '" << file.tempPath << "' to '" << file.path << "' (code " << err << ").";
 		throw std::runtime_error(ss.str());
 	}
   #endif
+	file.renamed = true;
 }
+
+static void pathDiscardTempFile(PendingFileWrite & file)
+{
+  #ifndef _WIN32
+	if (file.fd >= 0)
+	{
+		close(file.fd);
+		file.fd = -1;
+	}
+	if (!file.renamed && file.tempPath.length() > 0)
+		unlink(file.tempPath.c_str());
+  #else
+	if (file.handle != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(file.handle);
+		file.handle = INVALID_HANDLE_VALUE;
+	}
+	if (!file.renamed && file.tempPath.length() > 0)
+		DeleteFileA(file.tempPath.c_str());
+  #endif
+}
+
+static void pathSyncDirectory(const std::string & path)
+{
+  #ifndef _WIN32
+	PATH_UTIL_COUNT_SYSCALLS(3);
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		int err = errno;
+		std::stringstream ss;
+		ss << "unable to open directory '" << path << "': " << strerror(err);
+		throw std::runtime_error(ss.str());
+	}
+	int r = fsync(fd);
+	int err = errno;
+	close(fd);
+	// Some file systems do not support fsync on directories; there is nothing more we can do there.
+	if (r < 0 && err != EINVAL && err != ENOTSUP)
+	{
+		std::stringstream ss;
+		ss << "unable to flush directory '" << path << "': " << strerror(err);
+		throw std::runtime_error(ss.str());
+	}
+  #else
+	// MoveFileEx with MOVEFILE_WRITE_THROUGH does not return until the rename has been flushed.
+	(void)path;
+  #endif
+}
+
+static void pathSyncDirectories(const std::vector<PendingFileWrite> & files)
+{
+	std::vector<std::string> dirs;
+	dirs.reserve(files.size());
+	for (const PendingFileWrite & file : files)
+	{
+		if (file.renamed)
+			dirs.push_back(pathGetDirectoryForSync(file.path));
+	}
+	std::sort(dirs.begin(), dirs.end());
+	dirs.erase(std::unique(dirs.begin(), dirs.end()), dirs.end());
+
+	for (const std::string & dir : dirs)
+		pathSyncDirectory(dir);
+}
+
+void pathWriteFileAtomic(const std::string & path, const void * data, size_t size)
+{
+	// Bytes and entries are counted by pathWriteFilesAtomic() below.
+	PATH_UTIL_OPERATION(PathOp_WriteFileAtomic);
+
+	FileWriteRequestList files(1);
+	files[0].path = path;
+	files[0].data = data;
+	files[0].size = size;
+	pathWriteFilesAtomic(files);
+}
+
+void pathWriteFileAtomic(const std::string & path, const std::string & data)
+{
+	pathWriteFileAtomic(path, data.data(), data.length());
+}
+
+void pathWriteFilesAtomic(const FileWriteRequestList & files)
+{
+	PATH_UTIL_OPERATION(PathOp_WriteFilesAtomic);
+	PATH_UTIL_COUNT_ENTRIES(files.size());
+
+	std::vector<PendingFileWrite> pending(files.size());
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		pending[i].path = files[i].path;
+	  #ifndef _WIN32
+		pending[i].fd = -1;
+	  #else
+		pending[i].handle = INVALID_HANDLE_VALUE;
+	  #endif
+		pending[i].renamed = false;
+	}
+
+	// Files are written and flushed in groups of PathWriteGroupSize, so that at most that many descriptors are open
+	// at a time, however large the batch is. Nothing is renamed until every file of the batch is on disk.
+	//
+	// Each file gets its own fdatasync(), which reports writeback errors for exactly that file; syncfs() would
+	// flush the whole file system and older kernels do not report errors through it. The fdatasync() calls of a
+	// group are issued concurrently so that the file system can commit them together.
+	try
+	{
+		for (size_t group = 0; group < files.size(); group += PathWriteGroupSize)
+		{
+			size_t end = std::min(files.size(), group + PathWriteGroupSize);
+			for (size_t i = group; i < end; i++)
+			{
+				pathOpenTempFile(pending[i]);
+				pathWriteTempFile(pending[i], files[i].data, files[i].size);
+			}
+			pathSyncTempFiles(pending, group, end);
+			for (size_t i = group; i < end; i++)
+				pathCloseTempFile(pending[i]);
+		}
+
+		for (PendingFileWrite & file : pending)
+			pathRenameTempFile(file);
+	}
+	catch (...)
+	{
+		for (PendingFileWrite & file : pending)
+			pathDiscardTempFile(file);
+
+		// Files that have already been renamed stay in place, so make those renames durable as well. The original
+		// error is more useful to the caller than a failure here.
+		try
+		{
+			pathSyncDirectories(pending);
+		}
+		catch (...)
+		{
+		}
+
+		throw;
+	}
+
+	pathSyncDirectories(pending);
+}
+
+#ifdef PATH_UTIL_HAS_PMR
+
+std::pmr::string pathToNativeSeparators(std::string_view path, std::pmr::memory_resource * resource)
+{
+	PATH_UTIL_OPERATION(PathOp_ToNativeSeparators);
+	PATH_UTIL_COUNT_BYTES(path.length());
+	return pathToNativeSeparators<std::pmr::string>(path.data(), path.length(), resource);
+}
+
+std::pmr::string pathToUnixSeparators(std::string_view path, std::pmr::memory_resource * resource)
+{
+	PATH_UTIL_OPERATION(PathOp_ToUnixSeparators);
+	PATH_UTIL_COUNT_BYTES(path.length());
+	return pathToUnixSeparators<std::pmr::string>(path.data(), path.length(), resource);
+}
+
+std::pmr::string pathGetCurrentDirectory(std::pmr::memory_resource * resource)
+{
+	PATH_UTIL_OPERATION(PathOp_GetCurrentDirectory);
+  #ifndef _WIN32
+	char buf[PathBufferSize];
+	return std::pmr::string(pathGetCurrentDirectory(buf), resource);
+  #else
+	return std::pmr::string(pathGetCurrentDirectory(), resource);
+  #endif
+}
+
+std::pmr::string pathGetUserHomeDirectory(std::pmr::memory_resource * resource)
+{
+	PATH_UTIL_OPERATION(PathOp_GetUserHomeDirectory);
+	return pathGetUserHomeDirectory<std::pmr::string>(resource);
+}
+
+std::pmr::string pathMakeAbsolute(std::string_view path, std::string_view basePath,
+	std::pmr::memory_resource * resource)
+{
+	PATH_UTIL_OPERATION(PathOp_MakeAbsolute);
+	PATH_UTIL_COUNT_BYTES(path.length());
+	return pathMakeAbsolute<std::pmr::string>(path.data(), path.length(), basePath.data(), basePath.length(),
+		resource);
+}
+
+std::pmr::string pathMakeAbsolute(std::string_view path, std::pmr::memory_resource * resource)
+{
+	PATH_UTIL_OPERATION(PathOp_MakeAbsolute);
+  #ifndef _WIN32
+	std::pmr::string currentDirectory = pathGetCurrentDirectory(resource);
+	return pathMakeAbsolute(path, currentDirectory, resource);
+  #else
+	return std::pmr::string(pathMakeAbsolute(std::string(path)), resource);
+  #endif
+}
+
+std::pmr::string pathSimplify(std::string_view path, std::pmr::memory_resource * resource)
+{
+	PATH_UTIL_OPERATION(PathOp_Simplify);
+	PATH_UTIL_COUNT_BYTES(path.length());
+	return pathSimplify<std::pmr::string>(path.data(), path.length(), resource);
+}
+
+std::pmr::string pathMakeCanonical(std::string_view path, std::pmr::memory_resource * resource)
+{
+	PATH_UTIL_OPERATION(PathOp_MakeCanonical);
+	PATH_UTIL_COUNT_BYTES(path.length());
+  #ifndef _WIN32
+	std::pmr::string input(path, resource);
+	char buf[PathBufferSize];
+	return std::pmr::string(pathMakeCanonical(input.c_str(), buf), resource);
+  #else
+	return pathMakeAbsolute(path, resource);
+  #endif
+}
+
+std::pmr::string pathConcat(std::string_view path1, std::string_view path2, std::pmr::memory_resource * resource)
+{
+	PATH_UTIL_OPERATION(PathOp_Concat);
+	PATH_UTIL_COUNT_BYTES(path1.length() + path2.length());
+	return pathConcat<std::pmr::string>(path1.data(), path1.length(), path2.data(), path2.length(), resource);
+}
+
+std::pmr::string pathGetDirectory(std::string_view path, std::pmr::memory_resource * resource)
+{
+	PATH_UTIL_OPERATION(PathOp_GetDirectory);
+	PATH_UTIL_COUNT_BYTES(path.length());
+	return pathGetDirectory<std::pmr::string>(path.data(), path.length(), resource);
+}
+
+std::pmr::string pathGetFileName(std::string_view path, std::pmr::memory_resource * resource)
+{
+	PATH_UTIL_OPERATION(PathOp_GetFileName);
+	PATH_UTIL_COUNT_BYTES(path.length());
+	return pathGetFileName<std::pmr::string>(path.data(), path.length(), resource);
+}
+
+std::pmr::string pathGetShortFileExtension(std::string_view path, std::pmr::memory_resource * resource)
+{
+	PATH_UTIL_OPERATION(PathOp_GetShortFileExtension);
+	PATH_UTIL_COUNT_BYTES(path.length());
+	return pathGetShortFileExtension<std::pmr::string>(path.data(), path.length(), resource);
+}
+
+std::pmr::string pathGetFullFileExtension(std::string_view path, std::pmr::memory_resource * resource)
+{
+	PATH_UTIL_OPERATION(PathOp_GetFullFileExtension);
+	PATH_UTIL_COUNT_BYTES(path.length());
+	return pathGetFullFileExtension<std::pmr::string>(path.data(), path.length(), resource);
+}
+
+std::pmr::string pathReplaceFullFileExtension(std::string_view path, std::string_view ext,
+	std::pmr::memory_resource * resource)
+{
+	PATH_UTIL_OPERATION(PathOp_ReplaceFullFileExtension);
+	PATH_UTIL_COUNT_BYTES(path.length() + ext.length());
+	return pathReplaceFullFileExtension<std::pmr::string>(path.data(), path.length(), ext.data(), ext.length(),
+		resource);
+}
+
+PmrDirEntryList pathEnumDirectoryContents(std::string_view path, std::pmr::memory_resource * resource)
+{
+	PATH_UTIL_OPERATION(PathOp_EnumDirectoryContents);
+	std::pmr::string dir(path, resource);
+	return pathEnumDirectoryContents<PmrDirEntryList>(dir.c_str(), resource);
+}
+
+#endif
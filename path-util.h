@@ -24,9 +24,19 @@
 #define __dee757a372efbf0af613ed62448b8c05__
 
 #include <string>
+#include <cstring>
 #include <ctime>
+#include <cstdint>
 #include <vector>
 
+// The std::pmr overloads need C++17 and are only built when PATH_UTIL_PMR is defined. It has to be defined the
+// same way for the library and for code that uses it (the PATH_UTIL_PMR option in CMake takes care of that).
+#ifdef PATH_UTIL_PMR
+ #define PATH_UTIL_HAS_PMR 1
+ #include <memory_resource>
+ #include <string_view>
+#endif
+
 enum DirEntryType
 {
 	DirEntry_Unknown = 0,
@@ -47,6 +57,113 @@ struct DirEntry
 
 typedef std::vector<DirEntry> DirEntryList;
 
+#ifdef PATH_UTIL_HAS_PMR
+struct PmrDirEntry
+{
+	DirEntryType type;
+	std::pmr::string name;
+};
+
+typedef std::pmr::vector<PmrDirEntry> PmrDirEntryList;
+#endif
+
+struct FileWriteRequest
+{
+	std::string path;
+	const void * data;
+	size_t size;
+};
+
+typedef std::vector<FileWriteRequest> FileWriteRequestList;
+
+struct DiskUsageOptions
+{
+	size_t threads;
+	bool oneFileSystem;
+	bool collectFiles;
+
+	DiskUsageOptions() : threads(0), oneFileSystem(false), collectFiles(false) {}
+};
+
+struct DiskUsageEntry
+{
+	std::string path;
+	uint64_t apparentBytes;
+	uint64_t allocatedBytes;
+	uint64_t files;
+	uint64_t directories;
+};
+
+typedef std::vector<DiskUsageEntry> DiskUsageEntryList;
+
+struct DiskUsageFile
+{
+	std::string path;
+	uint64_t allocatedBytes;
+	time_t accessTime;
+};
+
+typedef std::vector<DiskUsageFile> DiskUsageFileList;
+
+struct DiskUsage
+{
+	DiskUsageEntry total;
+	DiskUsageEntryList directories;
+	DiskUsageFileList files;
+};
+
+enum PathOperation
+{
+	PathOp_ToNativeSeparators = 0,
+	PathOp_ToUnixSeparators,
+	PathOp_GetCurrentDirectory,
+	PathOp_GetUserHomeDirectory,
+	PathOp_IsAbsolute,
+	PathOp_MakeAbsolute,
+	PathOp_Simplify,
+	PathOp_MakeCanonical,
+	PathOp_Concat,
+	PathOp_GetDirectory,
+	PathOp_GetFileName,
+	PathOp_GetShortFileExtension,
+	PathOp_GetFullFileExtension,
+	PathOp_ReplaceFullFileExtension,
+	PathOp_Create,
+	PathOp_IsExistent,
+	PathOp_IsFile,
+	PathOp_GetModificationTime,
+	PathOp_GetThisExecutableFile,
+	PathOp_CreateSymLink,
+	PathOp_EnumDirectoryContents,
+	PathOp_DeleteFile,
+	PathOp_WriteFileAtomic,
+	PathOp_WriteFilesAtomic,
+	PathOp_MakeRelative,
+	PathOp_IsUnder,
+	PathOp_CommonPrefix,
+	PathOp_FindContainingRoots,
+	PathOp_DiskUsage,
+	PathOp_PlanEviction,
+	PathOp_Count
+};
+
+// Bucket N of the latency histogram counts calls that took [2^N, 2^(N+1)) nanoseconds;
+// the last bucket also counts everything slower than that.
+const size_t PathLatencyBucketCount = 32;
+
+struct PathOperationStats
+{
+	const char * name;
+	uint64_t calls;
+	uint64_t syscalls;
+	uint64_t bytes;
+	uint64_t entries;
+	uint64_t nanoseconds;
+	uint64_t latencyHistogram[PathLatencyBucketCount];
+};
+
+typedef std::vector<PathOperationStats> PathOperationStatsList;
+
 std::string pathToNativeSeparators(const std::string & path);
 std::string pathToUnixSeparators(const std::string & path);
 
@@ -71,6 +188,8 @@ std::string pathMakeCanonical(const std::string & path);
 std::string pathConcat(const std::string & path1, const std::string & path2);
 
 size_t pathIndexOfFileName(const std::string & path);
+size_t pathIndexOfFileName(const char * path, size_t length);
+size_t pathIndexOfFullFileExtension(const char * path, size_t length);
 std::string pathGetDirectory(const std::string & path);
 std::string pathGetFileName(const std::string & path);
 
@@ -78,12 +197,24 @@ std::string pathGetShortFileExtension(const std::string & path);
 std::string pathGetFullFileExtension(const std::string & path);
 std::string pathReplaceFullFileExtension(const std::string & path, const std::string & ext);
 
+// These compare paths component by component without touching the file system. ".." is not resolved, so pass
+// paths through pathSimplify() first if they may contain it.
+std::string pathMakeRelative(const std::string & path, const std::string & basePath);
+bool pathIsUnder(const std::string & path, const std::string & dir);
+size_t pathCommonPrefixLength(const std::string & path1, const std::string & path2);
+std::string pathCommonPrefix(const std::vector<std::string> & paths);
+std::vector<size_t> pathFindContainingRoots(const std::vector<std::string> & paths,
+	const std::vector<std::string> & roots);
+
 bool pathCreate(const std::string & path);
 
 bool pathIsExistent(const std::string & path);
+bool pathIsExistent(const char * path);
 bool pathIsFile(const std::string & path);
+bool pathIsFile(const char * path);
 
 time_t pathGetModificationTime(const std::string & path);
+time_t pathGetModificationTime(const char * path);
 
 std::string pathGetThisExecutableFile();
 
@@ -92,5 +223,181 @@ std::string pathCreateSymLink(const std::string & from, const std::string & to);
 DirEntryList pathEnumDirectoryContents(const std::string & path);
 
 void pathDeleteFile(const std::string & file);
+void pathDeleteFile(const char * file);
+
+DiskUsage pathDiskUsage(const std::string & path, const DiskUsageOptions & options = DiskUsageOptions());
+DiskUsageFileList pathPlanEviction(const DiskUsage & usage, uint64_t maxBytes);
+
+void pathWriteFileAtomic(const std::string & path, const void * data, size_t size);
+void pathWriteFileAtomic(const std::string & path, const std::string & data);
+void pathWriteFilesAtomic(const FileWriteRequestList & files);
+
+bool pathIsInstrumentationEnabled();
+PathOperationStatsList pathGetInstrumentationSnapshot();
+void pathResetInstrumentation();
+std::string pathFormatInstrumentationSnapshot(const PathOperationStatsList & stats);
+
+// Path value that keeps up to N bytes inline and only allocates when it grows past that. Components can be
+// appended and removed in place with the same rules as pathConcat() and pathGetDirectory(), so building and
+// stripping paths in a loop does not touch the heap.
+//
+// PathBuf converts to std::string, so it can be passed to any function in this file, but that conversion creates
+// a temporary string, which allocates for anything longer than the library's small string buffer. The file
+// queries below have overloads that take a PathBuf without that; the pmr overloads take it as a std::string_view.
+template <size_t N> class PathBuf
+{
+public:
+	PathBuf() : m_data(m_inline), m_length(0), m_capacity(N) { m_inline[0] = 0; }
+	PathBuf(const char * path) : PathBuf() { assign(path, strlen(path)); }
+	PathBuf(const char * path, size_t length) : PathBuf() { assign(path, length); }
+	PathBuf(const std::string & path) : PathBuf() { assign(path.data(), path.length()); }
+	PathBuf(const PathBuf & other) : PathBuf() { assign(other.m_data, other.m_length); }
+	PathBuf(PathBuf && other) noexcept : PathBuf() { take(other); }
+	~PathBuf() { if (m_data != m_inline) delete[] m_data; }
+
+	PathBuf & operator=(const PathBuf & other) { assign(other.m_data, other.m_length); return *this; }
+	PathBuf & operator=(PathBuf && other) noexcept { if (this != &other) take(other); return *this; }
+
+	const char * data() const { return m_data; }
+	const char * c_str() const { return m_data; }
+	size_t length() const { return m_length; }
+	size_t size() const { return m_length; }
+	size_t capacity() const { return m_capacity; }
+	bool empty() const { return m_length == 0; }
+	bool isInline() const { return m_data == m_inline; }
+
+	std::string str() const { return std::string(m_data, m_length); }
+	operator std::string() const { return str(); }
+  #ifdef PATH_UTIL_HAS_PMR
+	operator std::string_view() const noexcept { return std::string_view(m_data, m_length); }
+  #endif
+
+	void clear() { splice(0, 0, "", 0); }
+	void assign(const char * path, size_t length) { splice(0, 0, path, length); }
+
+	// Same result as pathConcat(*this, component).
+	PathBuf & appendComponent(const char * component, size_t length)
+	{
+		bool separator = (m_length > 0 && length > 0 && !pathIsSeparator(m_data[m_length - 1]));
+		splice(m_length, (separator ? *pathSeparator() : 0), component, length);
+		return *this;
+	}
+
+	PathBuf & appendComponent(const char * component) { return appendComponent(component, strlen(component)); }
+	PathBuf & appendComponent(const std::string & component)
+		{ return appendComponent(component.data(), component.length()); }
+
+	// Same result as pathGetDirectory(*this).
+	PathBuf & popComponent()
+	{
+		size_t pos = pathIndexOfFileName(m_data, m_length);
+		splice((pos > 0 ? pos - 1 : 0), 0, "", 0);
+		return *this;
+	}
+
+	// Same result as pathReplaceFullFileExtension(*this, ext).
+	PathBuf & replaceFullFileExtension(const char * ext, size_t length)
+	{
+		size_t pos = pathIndexOfFullFileExtension(m_data, m_length);
+		splice((pos == std::string::npos ? m_length : pos), 0, ext, length);
+		return *this;
+	}
+
+	PathBuf & replaceFullFileExtension(const char * ext) { return replaceFullFileExtension(ext, strlen(ext)); }
+	PathBuf & replaceFullFileExtension(const std::string & ext)
+		{ return replaceFullFileExtension(ext.data(), ext.length()); }
+
+private:
+	char * m_data;
+	size_t m_length;
+	size_t m_capacity;
+	char m_inline[N + 1];
+
+	// Inline contents have to be copied; heap buffers are handed over and `other` is left empty.
+	void take(PathBuf & other)
+	{
+		if (other.isInline())
+		{
+			assign(other.m_data, other.m_length);
+			return;
+		}
+
+		if (m_data != m_inline)
+			delete[] m_data;
+		m_data = other.m_data;
+		m_length = other.m_length;
+		m_capacity = other.m_capacity;
+
+		other.m_data = other.m_inline;
+		other.m_length = 0;
+		other.m_capacity = N;
+		other.m_inline[0] = 0;
+	}
+
+	// Truncates the buffer to `pos` bytes and appends an optional separator and `length` bytes of `str`. `str` may
+	// point into this buffer.
+	void splice(size_t pos, char separator, const char * str, size_t length)
+	{
+		size_t start = pos + (separator ? 1 : 0);
+		size_t newLength = start + length;
+		if (newLength <= m_capacity)
+		{
+			memmove(m_data + start, str, length);
+			if (separator)
+				m_data[pos] = separator;
+		}
+		else
+		{
+			size_t newCapacity = (newLength > m_capacity * 2 ? newLength : m_capacity * 2);
+			char * data = new char[newCapacity + 1];
+			memcpy(data, m_data, pos);
+			if (separator)
+				data[pos] = separator;
+			memcpy(data + start, str, length);
+			if (m_data != m_inline)
+				delete[] m_data;
+			m_data = data;
+			m_capacity = newCapacity;
+		}
+		m_length = newLength;
+		m_data[m_length] = 0;
+	}
+};
+
+template <size_t N> bool pathIsExistent(const PathBuf<N> & path) { return pathIsExistent(path.c_str()); }
+template <size_t N> bool pathIsFile(const PathBuf<N> & path) { return pathIsFile(path.c_str()); }
+template <size_t N> time_t pathGetModificationTime(const PathBuf<N> & path)
+	{ return pathGetModificationTime(path.c_str()); }
+template <size_t N> void pathDeleteFile(const PathBuf<N> & path) { pathDeleteFile(path.c_str()); }
+
+#ifdef PATH_UTIL_HAS_PMR
+// Results and all temporary strings are allocated from `resource`. On Windows, the functions that query the system
+// (current and home directory, absolute and canonical paths) call the std::string versions and copy the result.
+std::pmr::string pathToNativeSeparators(std::string_view path, std::pmr::memory_resource * resource);
+std::pmr::string pathToUnixSeparators(std::string_view path, std::pmr::memory_resource * resource);
+
+std::pmr::string pathGetCurrentDirectory(std::pmr::memory_resource * resource);
+std::pmr::string pathGetUserHomeDirectory(std::pmr::memory_resource * resource);
+
+std::pmr::string pathMakeAbsolute(std::string_view path, std::string_view basePath,
+	std::pmr::memory_resource * resource);
+std::pmr::string pathMakeAbsolute(std::string_view path, std::pmr::memory_resource * resource);
+
+std::pmr::string pathSimplify(std::string_view path, std::pmr::memory_resource * resource);
+
+std::pmr::string pathMakeCanonical(std::string_view path, std::pmr::memory_resource * resource);
+
+std::pmr::string pathConcat(std::string_view path1, std::string_view path2, std::pmr::memory_resource * resource);
+
+std::pmr::string pathGetDirectory(std::string_view path, std::pmr::memory_resource * resource);
+std::pmr::string pathGetFileName(std::string_view path, std::pmr::memory_resource * resource);
+
+std::pmr::string pathGetShortFileExtension(std::string_view path, std::pmr::memory_resource * resource);
+std::pmr::string pathGetFullFileExtension(std::string_view path, std::pmr::memory_resource * resource);
+std::pmr::string pathReplaceFullFileExtension(std::string_view path, std::string_view ext,
+	std::pmr::memory_resource * resource);
+
+PmrDirEntryList pathEnumDirectoryContents(std::string_view path, std::pmr::memory_resource * resource);
+#endif
 
 #endif